@@ -0,0 +1,112 @@
+#include "arena.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+struct arena_chunk {
+    arena_chunk_t* next;
+    size_t cap;                     // whole buffer, header included
+};
+
+#define CHUNK_HEADER ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void arena_init(arena_t* arena, buf_pool_t* pool) {
+    memset(arena, 0, sizeof(*arena));
+    arena->pool = pool;
+}
+
+// start a chunk with room for at least size bytes; chunks double so a
+// request that keeps allocating needs few of them
+static bool arena_grow(arena_t* arena, size_t size) {
+    size_t want = CHUNK_HEADER + size;
+    if (arena->chunks && want < arena->chunks->cap * 2) {
+        want = arena->chunks->cap * 2;
+    }
+
+    size_t cap;
+    char* buf = buf_alloc(arena->pool, want, &cap);
+    if (!buf) {
+        return false;
+    }
+    arena_chunk_t* chunk = (arena_chunk_t*)buf;
+    chunk->next = arena->chunks;
+    chunk->cap = cap;
+    arena->chunks = chunk;
+    arena->ptr = buf + CHUNK_HEADER;
+    arena->end = buf + cap;
+    return true;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    size = align_up(size);
+    if ((size_t)(arena->end - arena->ptr) < size && !arena_grow(arena, size)) {
+        return NULL;
+    }
+    void* p = arena->ptr;
+    arena->ptr += size;
+    return p;
+}
+
+void arena_reset(arena_t* arena) {
+    while (arena->chunks) {
+        arena_chunk_t* chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        buf_free(arena->pool, (char*)chunk, chunk->cap);
+    }
+    arena->ptr = arena->end = NULL;
+}
+
+// make room for at least need bytes in str: extend it in place when nothing
+// was allocated after it, otherwise move it to a new, larger block
+static bool str_reserve(arena_str_t* str, size_t need) {
+    arena_t* arena = str->arena;
+    size_t cap = align_up(need > 2 * str->cap ? need : 2 * str->cap);
+    if (str->data && str->data + str->cap == arena->ptr &&
+        (size_t)(arena->end - str->data) >= cap) {
+        arena->ptr = str->data + cap;
+        str->cap = cap;
+        return true;
+    }
+
+    char* data = arena_alloc(arena, cap);
+    if (!data) {
+        return false;
+    }
+    if (str->len > 0) {
+        memcpy(data, str->data, str->len);
+    }
+    str->data = data;
+    str->cap = cap;
+    return true;
+}
+
+void arena_printf(arena_str_t* str, const char* fmt, ...) {
+    if (str->failed) {
+        return;
+    }
+
+    for (;;) {
+        size_t avail = str->cap - str->len;
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(avail ? str->data + str->len : NULL, avail, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            str->failed = true;
+            return;
+        }
+        if ((size_t)n < avail) {
+            str->len += n;
+            return;
+        }
+        if (!str_reserve(str, str->len + n + 1)) {
+            str->failed = true;
+            return;
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pool.h"
+
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk arena_chunk_t;
+
+// bump-pointer scratch memory for one request. Chunks come from the owning
+// worker's buffer pool on first use and all go back to it on arena_reset(),
+// so a request that allocates nothing costs nothing and one that does
+// never reaches malloc once the pool is warm.
+typedef struct {
+    buf_pool_t* pool;
+    arena_chunk_t* chunks;          // most recent first
+    char* ptr;                      // free space in the current chunk
+    char* end;
+} arena_t;
+
+// a string built up in an arena with arena_printf(); failed sticks once an
+// append could not get memory, so callers check it once at the end
+typedef struct {
+    arena_t* arena;
+    char* data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} arena_str_t;
+
+void arena_init(arena_t* arena, buf_pool_t* pool);
+// ARENA_ALIGN-aligned; NULL if the pool is out of memory
+void* arena_alloc(arena_t* arena, size_t size);
+// release everything allocated so far back to the pool
+void arena_reset(arena_t* arena);
+
+// append to str, growing it in place while it is the last allocation in
+// its arena
+void arena_printf(arena_str_t* str, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,286 @@
+#include "compress.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define COMPRESS_BUCKET_BYTES 8192  // expected bytes per cached body, for sizing the table
+#define COMPRESS_CHUNK 16384        // file bytes read per deflate() call
+
+const char* const compress_coding_names[COMPRESS_CODINGS] = { "gzip", "deflate" };
+
+// a type ending in '/' stands for all of its subtypes
+static const char* const compressible_types[] = {
+    "text/",
+    "application/json",
+    "application/javascript",
+    "application/xml",
+    "application/wasm",
+    "image/svg+xml",
+};
+
+bool compress_type_allowed(const char* type, size_t len) {
+    const char* semicolon = memchr(type, ';', len);
+    if (semicolon) {
+        len = semicolon - type;
+    }
+    while (len > 0 && (type[len - 1] == ' ' || type[len - 1] == '\t')) {
+        len--;
+    }
+    for (size_t i = 0; i < sizeof(compressible_types) / sizeof(compressible_types[0]); i++) {
+        const char* allowed = compressible_types[i];
+        size_t allowed_len = strlen(allowed);
+        bool any_subtype = allowed[allowed_len - 1] == '/';
+        if ((any_subtype ? len > allowed_len : len == allowed_len) &&
+            strncasecmp(type, allowed, allowed_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int compressor_init(compressor_t* comp, size_t capacity, size_t body_max) {
+    memset(comp, 0, sizeof(*comp));
+    comp->capacity = capacity;
+    comp->body_max = body_max;
+    comp->num_buckets = 16;
+    while (comp->num_buckets * COMPRESS_BUCKET_BYTES < capacity) {
+        comp->num_buckets *= 2;
+    }
+    comp->buckets = calloc(comp->num_buckets, sizeof(compressed_t*));
+    return comp->buckets ? 0 : -1;
+}
+
+void compressed_release(compressed_t* body) {
+    if (--body->refs == 0) {
+        free(body);
+    }
+}
+
+// drop the cache's reference; queued sends keep the data until they finish
+static void unlink_body(compressor_t* comp, compressed_t* body) {
+    compressed_t** link = &comp->buckets[body->hash & (comp->num_buckets - 1)];
+    while (*link != body) {
+        link = &(*link)->hash_next;
+    }
+    *link = body->hash_next;
+
+    if (body->lru_prev) {
+        body->lru_prev->lru_next = body->lru_next;
+    } else {
+        comp->newest = body->lru_next;
+    }
+    if (body->lru_next) {
+        body->lru_next->lru_prev = body->lru_prev;
+    } else {
+        comp->oldest = body->lru_prev;
+    }
+    comp->bytes -= body->charge;
+    body->cached = false;
+    compressed_release(body);
+}
+
+void compressor_destroy(compressor_t* comp) {
+    while (comp->oldest) {
+        unlink_body(comp, comp->oldest);
+    }
+    for (int i = 0; i < COMPRESS_CODINGS; i++) {
+        if (comp->ready[i]) {
+            deflateEnd(&comp->streams[i]);
+        }
+    }
+    free(comp->buckets);
+    memset(comp, 0, sizeof(*comp));
+}
+
+// splitmix64 finalizer
+static uint64_t mix(uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+// only picks the bucket; a hit compares the whole key
+static uint64_t key_hash(const compress_key_t* key) {
+    uint64_t h = mix((uint64_t)key->dev);
+    h = mix(h ^ (uint64_t)key->ino);
+    h = mix(h ^ (uint64_t)key->size);
+    h = mix(h ^ (uint64_t)key->changed.tv_sec);
+    return mix(h ^ (uint64_t)key->changed.tv_nsec);
+}
+
+static bool key_equal(const compress_key_t* a, const compress_key_t* b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->changed.tv_sec == b->changed.tv_sec && a->changed.tv_nsec == b->changed.tv_nsec;
+}
+
+compressed_t* compress_lookup(compressor_t* comp, compress_coding_t coding,
+                              const compress_key_t* key) {
+    uint64_t hash = key_hash(key);
+    compressed_t* body = comp->buckets[hash & (comp->num_buckets - 1)];
+    for (; body; body = body->hash_next) {
+        if (body->hash == hash && body->coding == coding && key_equal(&body->key, key)) {
+            break;
+        }
+    }
+    if (!body) {
+        return NULL;
+    }
+    if (body != comp->newest) {
+        body->lru_prev->lru_next = body->lru_next;
+        if (body->lru_next) {
+            body->lru_next->lru_prev = body->lru_prev;
+        } else {
+            comp->oldest = body->lru_prev;
+        }
+        body->lru_prev = NULL;
+        body->lru_next = comp->newest;
+        comp->newest->lru_prev = body;
+        comp->newest = body;
+    }
+    body->refs++;
+    return body;
+}
+
+// the coding's stream, ready for a new body
+static z_stream* stream_for(compressor_t* comp, compress_coding_t coding) {
+    z_stream* zs = &comp->streams[coding];
+    if (comp->ready[coding]) {
+        return deflateReset(zs) == Z_OK ? zs : NULL;
+    }
+    memset(zs, 0, sizeof(*zs));
+    int window_bits = coding == COMPRESS_GZIP ? 15 + 16 : 15;
+    if (deflateInit2(zs, COMPRESS_LEVEL, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    comp->ready[coding] = true;
+    return zs;
+}
+
+// room for the worst case, so deflate() never runs out of output space
+static compressed_t* body_alloc(z_stream* zs, size_t len) {
+    size_t bound = deflateBound(zs, len);
+    compressed_t* body = malloc(sizeof(compressed_t) + bound);
+    if (!body) {
+        return NULL;
+    }
+    zs->next_out = (Bytef*)body->data;
+    zs->avail_out = bound;
+    return body;
+}
+
+// trim a finished body to its length; returned with the caller's reference
+static compressed_t* body_finish(compressed_t* body, z_stream* zs, compress_coding_t coding) {
+    size_t len = zs->total_out;
+    compressed_t* trimmed = realloc(body, sizeof(compressed_t) + len);
+    if (trimmed) {
+        body = trimmed;
+    }
+    body->coding = coding;
+    body->refs = 1;
+    body->cached = false;
+    body->charge = sizeof(compressed_t) + len;
+    body->len = len;
+    return body;
+}
+
+// finish a body and put it in the cache under key, evicting from the cold end
+static compressed_t* body_insert(compressor_t* comp, compressed_t* body, z_stream* zs,
+                                 compress_coding_t coding, const compress_key_t* key) {
+    body = body_finish(body, zs, coding);
+    body->key = *key;
+    body->hash = key_hash(key);
+    if (body->charge > comp->capacity) {
+        return body;
+    }
+    while (comp->bytes + body->charge > comp->capacity) {
+        unlink_body(comp, comp->oldest);
+    }
+
+    compressed_t** bucket = &comp->buckets[body->hash & (comp->num_buckets - 1)];
+    body->hash_next = *bucket;
+    *bucket = body;
+    body->lru_prev = NULL;
+    body->lru_next = comp->newest;
+    if (comp->newest) {
+        comp->newest->lru_prev = body;
+    } else {
+        comp->oldest = body;
+    }
+    comp->newest = body;
+    comp->bytes += body->charge;
+    body->cached = true;
+    body->refs++;
+    return body;
+}
+
+compressed_t* compress_body(compressor_t* comp, compress_coding_t coding, const void* data,
+                            size_t len) {
+    if (len > comp->body_max) {
+        return NULL;
+    }
+    z_stream* zs = stream_for(comp, coding);
+    compressed_t* body = zs ? body_alloc(zs, len) : NULL;
+    if (!body) {
+        return NULL;
+    }
+    zs->next_in = (Bytef*)data;
+    zs->avail_in = len;
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END) {
+        free(body);
+        return NULL;
+    }
+    return body_finish(body, zs, coding);
+}
+
+// all of len bytes from off; false at EOF or on error
+static bool read_full(int fd, unsigned char* buf, size_t len, off_t off) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, off + done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+compressed_t* compress_file(compressor_t* comp, compress_coding_t coding, int fd,
+                            const compress_key_t* key) {
+    off_t size = key->size;
+    if ((size_t)size > comp->body_max) {
+        return NULL;
+    }
+    z_stream* zs = stream_for(comp, coding);
+    compressed_t* body = zs ? body_alloc(zs, size) : NULL;
+    if (!body) {
+        return NULL;
+    }
+
+    unsigned char chunk[COMPRESS_CHUNK];
+    for (off_t off = 0; off < size; ) {
+        size_t want = size - off < COMPRESS_CHUNK ? (size_t)(size - off) : COMPRESS_CHUNK;
+        if (!read_full(fd, chunk, want, off)) {
+            free(body);
+            return NULL;
+        }
+        zs->next_in = chunk;
+        zs->avail_in = want;
+        if (deflate(zs, Z_NO_FLUSH) != Z_OK) {
+            free(body);
+            return NULL;
+        }
+        off += want;
+    }
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END) {
+        free(body);
+        return NULL;
+    }
+    return body_insert(comp, body, zs, coding, key);
+}
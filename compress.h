@@ -0,0 +1,93 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <zlib.h>
+
+#define COMPRESS_LEVEL 6            // zlib default: near level 9 ratios for far less CPU
+
+// codings produced on the fly, in order of preference on a tie
+typedef enum {
+    COMPRESS_GZIP,
+    COMPRESS_DEFLATE,               // the zlib format, as HTTP's "deflate" means
+    COMPRESS_CODINGS,
+} compress_coding_t;
+
+extern const char* const compress_coding_names[COMPRESS_CODINGS];
+
+// the file, and the version of it, a cached body was compressed from. It is
+// compared in full on lookup, so a body is only ever served for the file it
+// came from, whatever the content of other files.
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec changed;        // st_ctim, moves on every write
+} compress_key_t;
+
+// one compressed body. The cache holds a reference while it is listed and
+// queued responses hold one each, so eviction never pulls data from under
+// a send.
+typedef struct compressed {
+    struct compressed* hash_next;
+    struct compressed* lru_prev;    // towards the most recently used
+    struct compressed* lru_next;
+    compress_key_t key;
+    uint64_t hash;                  // of key
+    compress_coding_t coding;
+    int refs;
+    bool cached;
+    size_t charge;                  // bytes counted against the cache
+    size_t len;
+    char data[];
+} compressed_t;
+
+// per-worker compression state, never shared: a z_stream per coding, set
+// up on first use and reset between bodies instead of being rebuilt, and
+// an LRU of compressed files keyed by file identity, so a file requested
+// again under any name is compressed only once
+typedef struct {
+    z_stream streams[COMPRESS_CODINGS];
+    bool ready[COMPRESS_CODINGS];
+    compressed_t** buckets;
+    size_t num_buckets;             // power of two
+    compressed_t* newest;
+    compressed_t* oldest;
+    size_t bytes;
+    size_t capacity;
+    size_t body_max;                // larger bodies are sent as they are
+} compressor_t;
+
+// returns 0 or -1 with errno set
+int compressor_init(compressor_t* comp, size_t capacity, size_t body_max);
+void compressor_destroy(compressor_t* comp);
+
+// is a Content-Type value (up to any parameters) on the allowlist of types
+// worth compressing? Text, JSON, JavaScript, XML, SVG and wasm are;
+// images, fonts and video already are compressed.
+bool compress_type_allowed(const char* type, size_t len);
+
+// the cached compressed form of this version of a file, with a reference
+// held, or NULL
+compressed_t* compress_lookup(compressor_t* comp, compress_coding_t coding,
+                              const compress_key_t* key);
+
+// compress a body in memory, for one response: it is not cached, since
+// there is nothing but its bytes to know it by, and is freed once sent.
+// Returned with a reference held, NULL if it is too large or memory runs out.
+compressed_t* compress_body(compressor_t* comp, compress_coding_t coding, const void* data,
+                            size_t len);
+
+// compress key->size bytes of a file as pread() streams them through in
+// chunks, and cache the result under key. NULL if the file is too large,
+// got shorter while being read or memory runs out.
+compressed_t* compress_file(compressor_t* comp, compress_coding_t coding, int fd,
+                            const compress_key_t* key);
+
+void compressed_release(compressed_t* body);
+
+#endif
@@ -0,0 +1,251 @@
+#include "conditional.h"
+
+#include <string.h>
+#include <strings.h>
+
+static const char* skip_space(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+// is the target's tag in a comma separated list of entity tags? Weak
+// comparison ignores W/ prefixes, strong comparison never matches them
+static bool etag_matches(http_slice_t list, const cond_target_t* target, bool weak) {
+    const char* p = list.ptr;
+    const char* end = list.ptr + list.len;
+    for (;;) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        if (p == end) {
+            return false;
+        }
+        if (*p == '*') {
+            return true;
+        }
+        bool is_weak = end - p >= 2 && p[0] == 'W' && p[1] == '/';
+        if (is_weak) {
+            p += 2;
+        }
+        if (p == end || *p != '"') {
+            return false;
+        }
+        const char* close = memchr(p + 1, '"', end - p - 1);
+        if (!close) {
+            return false;
+        }
+        size_t len = close + 1 - p;
+        if ((weak || !is_weak) && len == target->etag_len && memcmp(p, target->etag, len) == 0) {
+            return true;
+        }
+        p = close + 1;
+    }
+}
+
+bool http_date_parse(http_slice_t value, time_t* t) {
+    static const char* const formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",    // IMF-fixdate
+        "%A, %d-%b-%y %H:%M:%S GMT",    // RFC 850
+        "%a %b %e %H:%M:%S %Y",         // asctime
+    };
+
+    char buf[64];
+    if (value.len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, value.ptr, value.len);
+    buf[value.len] = '\0';
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(buf, formats[i], &tm);
+        if (end && *end == '\0') {
+            *t = timegm(&tm);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cond_not_modified(const http_request_t* req, const cond_target_t* target) {
+    const http_slice_t* none_match = http_find_header(req, "If-None-Match");
+    if (none_match) {
+        return etag_matches(*none_match, target, true);
+    }
+
+    // a date in the future says nothing about the file, RFC 9110 13.1.3
+    const http_slice_t* since = http_find_header(req, "If-Modified-Since");
+    time_t date;
+    return since && http_date_parse(*since, &date) && date <= time(NULL) &&
+           target->mtime <= date;
+}
+
+// If-Range holds one validator: a strong entity tag, or the Last-Modified date
+static bool if_range_matches(http_slice_t value, const cond_target_t* target) {
+    if (value.len > 0 && (value.ptr[0] == '"' || value.ptr[0] == 'W')) {
+        return etag_matches(value, target, false);
+    }
+    time_t date;
+    return http_date_parse(value, &date) && date == target->mtime;
+}
+
+static bool parse_offset(const char** p, const char* end, off_t* value) {
+    const char* start = *p;
+    off_t n = 0;
+    while (*p < end && **p >= '0' && **p <= '9') {
+        if (*p - start == 18) {
+            return false;       // would overflow
+        }
+        n = n * 10 + (**p - '0');
+        (*p)++;
+    }
+    *value = n;
+    return *p > start;
+}
+
+range_result_t range_evaluate(const http_request_t* req, const cond_target_t* target,
+                              byte_range_t ranges[RANGE_MAX], int* count) {
+    *count = 0;
+    const http_slice_t* range = http_find_header(req, "Range");
+    if (!range) {
+        return RANGE_NONE;
+    }
+    const http_slice_t* if_range = http_find_header(req, "If-Range");
+    if (if_range && !if_range_matches(*if_range, target)) {
+        return RANGE_NONE;
+    }
+    if (range->len < 6 || strncasecmp(range->ptr, "bytes=", 6) != 0) {
+        return RANGE_NONE;
+    }
+
+    const char* p = range->ptr + 6;
+    const char* end = range->ptr + range->len;
+    int specs = 0;
+    for (;;) {
+        p = skip_space(p, end);
+        if (p < end && *p == ',') {
+            p++;
+            continue;
+        }
+        if (p == end) {
+            break;
+        }
+
+        // first-last, first- or -suffix
+        off_t first = -1;
+        off_t last = -1;
+        if (*p != '-' && !parse_offset(&p, end, &first)) {
+            return RANGE_NONE;
+        }
+        if (p == end || *p != '-') {
+            return RANGE_NONE;
+        }
+        p++;
+        if (p < end && *p >= '0' && *p <= '9' && !parse_offset(&p, end, &last)) {
+            return RANGE_NONE;
+        }
+        p = skip_space(p, end);
+        if ((p < end && *p != ',') || (first < 0 && last < 0) ||
+            (first >= 0 && last >= 0 && last < first) || ++specs > RANGE_MAX) {
+            return RANGE_NONE;
+        }
+
+        // clamp to the body; ranges entirely past it are dropped
+        off_t start;
+        off_t stop;
+        if (first < 0) {
+            if (last == 0 || target->size == 0) {
+                continue;
+            }
+            start = last >= target->size ? 0 : target->size - last;
+            stop = target->size;
+        } else {
+            if (first >= target->size) {
+                continue;
+            }
+            start = first;
+            stop = last < 0 || last >= target->size ? target->size : last + 1;
+        }
+        ranges[*count].start = start;
+        ranges[*count].len = stop - start;
+        (*count)++;
+    }
+
+    if (specs == 0) {
+        return RANGE_NONE;
+    }
+    return *count > 0 ? RANGE_PARTIAL : RANGE_UNSATISFIABLE;
+}
+
+// "0", "1" or either with up to three decimals; -1 if malformed
+static int parse_qvalue(const char* p, const char* end) {
+    if (p == end || (*p != '0' && *p != '1')) {
+        return -1;
+    }
+    int q = (*p++ - '0') * 1000;
+    if (p < end && *p == '.') {
+        p++;
+        for (int scale = 100; scale > 0 && p < end && *p >= '0' && *p <= '9'; scale /= 10) {
+            q += (*p++ - '0') * scale;
+        }
+    }
+    p = skip_space(p, end);
+    return p == end && q <= 1000 ? q : -1;
+}
+
+void accept_encoding_weights(http_slice_t value, const char* const names[], int count,
+                             int weights[]) {
+    for (int i = 0; i < count; i++) {
+        weights[i] = -1;
+    }
+    int any = 0;
+
+    const char* p = value.ptr;
+    const char* end = value.ptr + value.len;
+    while (p < end) {
+        const char* next = memchr(p, ',', end - p);
+        if (!next) {
+            next = end;
+        }
+        // coding *( OWS ";" OWS parameter ); only q matters
+        p = skip_space(p, next);
+        const char* coding = p;
+        while (p < next && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        size_t coding_len = p - coding;
+        int q = 1000;
+        const char* param = memchr(p, ';', next - p);
+        while (param) {
+            const char* stop = memchr(param + 1, ';', next - param - 1);
+            const char* name = skip_space(param + 1, next);
+            if (next - name >= 2 && (name[0] == 'q' || name[0] == 'Q') && name[1] == '=') {
+                q = parse_qvalue(name + 2, stop ? stop : next);
+            }
+            param = stop;
+        }
+        p = next < end ? next + 1 : end;
+
+        if (coding_len == 0 || q < 0) {
+            continue;
+        }
+        if (coding_len == 1 && coding[0] == '*') {
+            any = q;
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (strlen(names[i]) == coding_len && strncasecmp(coding, names[i], coding_len) == 0) {
+                weights[i] = q;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (weights[i] < 0) {
+            weights[i] = any;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "http_parser.h"
+
+#define RANGE_MAX 8                 // more ranges than this and the whole body is sent
+
+// the validators a static response is checked against
+typedef struct {
+    const char* etag;               // quoted, strong
+    size_t etag_len;
+    time_t mtime;                   // Last-Modified
+    off_t size;
+} cond_target_t;
+
+typedef struct {
+    off_t start;
+    off_t len;
+} byte_range_t;
+
+typedef enum {
+    RANGE_NONE,                     // no usable Range: send the whole body
+    RANGE_PARTIAL,                  // send the ranges, 206
+    RANGE_UNSATISFIABLE,            // none of them overlaps the body, 416
+} range_result_t;
+
+// If-None-Match, or failing that If-Modified-Since: true if a GET or HEAD
+// should get 304 Not Modified
+bool cond_not_modified(const http_request_t* req, const cond_target_t* target);
+
+// Range and If-Range for a GET. Ranges are clamped to the body and kept
+// in request order; a header with bad syntax, another unit, more than
+// RANGE_MAX ranges or a stale If-Range is ignored, as RFC 9110 allows.
+range_result_t range_evaluate(const http_request_t* req, const cond_target_t* target,
+                              byte_range_t ranges[RANGE_MAX], int* count);
+
+// weights[i] is the q-value, in thousandths, Accept-Encoding gives
+// names[i]: 0 when the client won't take it. A coding the header doesn't
+// list gets what "*" gets, or 0.
+void accept_encoding_weights(http_slice_t value, const char* const names[], int count,
+                             int weights[]);
+
+// IMF-fixdate, or the obsolete RFC 850 and asctime forms; false if invalid
+bool http_date_parse(http_slice_t value, time_t* t);
+
+#endif
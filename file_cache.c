@@ -0,0 +1,559 @@
+#include "file_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/openat2.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "compress.h"
+
+#define FILE_WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_WATCH_MASK (IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+const char* const file_encoding_names[FILE_ENCODINGS] = { "br", "zstd", "gzip" };
+static const char* const encoding_suffixes[FILE_ENCODINGS] = { ".br", ".zst", ".gz" };
+
+static const struct {
+    const char* ext;
+    const char* type;
+} content_types[] = {
+    { "html", "text/html; charset=utf-8" },
+    { "htm", "text/html; charset=utf-8" },
+    { "css", "text/css; charset=utf-8" },
+    { "js", "text/javascript; charset=utf-8" },
+    { "mjs", "text/javascript; charset=utf-8" },
+    { "json", "application/json" },
+    { "txt", "text/plain; charset=utf-8" },
+    { "xml", "application/xml" },
+    { "svg", "image/svg+xml" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "webp", "image/webp" },
+    { "avif", "image/avif" },
+    { "ico", "image/x-icon" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },
+    { "mp4", "video/mp4" },
+    { "webm", "video/webm" },
+};
+
+static const char* content_type(const char* name) {
+    const char* dot = strrchr(name, '.');
+    if (dot) {
+        for (size_t i = 0; i < sizeof(content_types) / sizeof(content_types[0]); i++) {
+            if (strcasecmp(dot + 1, content_types[i].ext) == 0) {
+                return content_types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+static uint64_t hash_key(const char* key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+int file_cache_init(file_cache_t* cache, const char* root, size_t max_entries,
+                    off_t compress_min, off_t compress_max) {
+    memset(cache, 0, sizeof(*cache));
+    cache->root_fd = -1;
+    cache->inotify_fd = -1;
+    cache->max_entries = max_entries;
+    cache->compress_min = compress_min;
+    cache->compress_max = compress_max;
+    cache->num_buckets = 16;
+    while (cache->num_buckets < max_entries * 2) {
+        cache->num_buckets *= 2;
+    }
+
+    cache->root = realpath(root, NULL);
+    cache->buckets = calloc(cache->num_buckets, sizeof(file_entry_t*));
+    if (!cache->root || !cache->buckets) {
+        goto fail;
+    }
+    cache->root_fd = open(cache->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->root_fd == -1 || cache->inotify_fd == -1) {
+        goto fail;
+    }
+    return 0;
+
+fail: {
+        int err = errno;
+        file_cache_destroy(cache);
+        errno = err;
+        return -1;
+    }
+}
+
+void file_cache_release(file_entry_t* entry) {
+    if (--entry->refs == 0) {
+        for (int i = 0; i < FILE_ENCODINGS; i++) {
+            if (entry->encoded[i]) {
+                file_cache_release(entry->encoded[i]);
+            }
+        }
+        close(entry->fd);
+        free(entry->key);
+        free(entry);
+    }
+}
+
+// is wd the watch on the file or on one of its sidecars?
+static bool watches_file(const file_entry_t* entry, int wd) {
+    if (entry->file_wd == wd) {
+        return true;
+    }
+    for (int i = 0; i < FILE_ENCODINGS; i++) {
+        if (entry->encoded[i] && entry->encoded[i]->file_wd == wd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the same inode can be cached under several paths ("/" and
+// "/index.html"); its watch goes with the last of them
+static void release_watch(file_cache_t* cache, int wd) {
+    if (wd == -1) {
+        return;
+    }
+    for (file_entry_t* entry = cache->oldest; entry; entry = entry->fifo_next) {
+        if (watches_file(entry, wd)) {
+            return;
+        }
+    }
+    inotify_rm_watch(cache->inotify_fd, wd);
+}
+
+static void release_watches(file_cache_t* cache, const file_entry_t* entry) {
+    release_watch(cache, entry->file_wd);
+    for (int i = 0; i < FILE_ENCODINGS; i++) {
+        if (entry->encoded[i]) {
+            release_watch(cache, entry->encoded[i]->file_wd);
+        }
+    }
+}
+
+// take an entry out of the table; queued sends keep it alive until they finish
+static void unlink_entry(file_cache_t* cache, file_entry_t* entry) {
+    size_t bucket = entry->hash & (cache->num_buckets - 1);
+    file_entry_t** link = &cache->buckets[bucket];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    if (entry->fifo_prev) {
+        entry->fifo_prev->fifo_next = entry->fifo_next;
+    } else {
+        cache->oldest = entry->fifo_next;
+    }
+    if (entry->fifo_next) {
+        entry->fifo_next->fifo_prev = entry->fifo_prev;
+    } else {
+        cache->newest = entry->fifo_prev;
+    }
+    entry->cached = false;
+    cache->count--;
+    release_watches(cache, entry);
+    for (int i = 0; i < FILE_ENCODINGS; i++) {
+        if (entry->encoded[i]) {
+            entry->encoded[i]->cached = false;
+        }
+    }
+    file_cache_release(entry);
+}
+
+void file_cache_destroy(file_cache_t* cache) {
+    while (cache->oldest) {
+        unlink_entry(cache, cache->oldest);
+    }
+    if (cache->inotify_fd != -1) {
+        close(cache->inotify_fd);
+    }
+    if (cache->root_fd != -1) {
+        close(cache->root_fd);
+    }
+    free(cache->buckets);
+    free(cache->root);
+    memset(cache, 0, sizeof(*cache));
+    cache->root_fd = cache->inotify_fd = -1;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// percent-decode a request path into a path relative to the root, mapping
+// directories to their index.html; false for anything that isn't a plain
+// path below the root
+static bool resolve_path(const char* path, size_t len, char* out, size_t size) {
+    if (len == 0 || path[0] != '/') {
+        return false;
+    }
+
+    size_t n = 0;
+    for (size_t i = 1; i < len; i++) {
+        char c = path[i];
+        if (c == '%') {
+            int hi = i + 2 < len ? hex_value(path[i + 1]) : -1;
+            int lo = i + 2 < len ? hex_value(path[i + 2]) : -1;
+            if (hi < 0 || lo < 0) {
+                return false;
+            }
+            c = (char)(hi << 4 | lo);
+            i += 2;
+        }
+        if (c == '\0' || n + 1 >= size) {
+            return false;
+        }
+        // "//" would make the next segment look absolute to the checks below
+        if (c == '/' && (n == 0 || out[n - 1] == '/')) {
+            continue;
+        }
+        out[n++] = c;
+    }
+    out[n] = '\0';
+
+    // ".." is refused outright; openat2() with RESOLVE_BENEATH, or the
+    // component walk without it, also stops symlinks leading out of the root
+    for (const char* seg = out; *seg; ) {
+        size_t seg_len = strcspn(seg, "/");
+        if (seg_len == 2 && seg[0] == '.' && seg[1] == '.') {
+            return false;
+        }
+        seg += seg_len;
+        if (*seg == '/') seg++;
+    }
+
+    if (n == 0 || out[n - 1] == '/') {
+        const char* index = "index.html";
+        if (n + strlen(index) + 1 > size) {
+            return false;
+        }
+        strcpy(out + n, index);
+    }
+    return true;
+}
+
+// without openat2() (before Linux 5.6): walk the path one component at a
+// time and refuse a symlink anywhere on it, not just at the end, so none
+// can lead out of the root. Stricter than RESOLVE_BENEATH, which follows
+// those that stay inside.
+static int open_walk(int root_fd, const char* rel) {
+    int dir_fd = root_fd;
+    size_t len;
+    while (rel[len = strcspn(rel, "/")] == '/') {
+        char name[NAME_MAX + 1];
+        int next = -1;
+        if (len > NAME_MAX) {
+            errno = ENAMETOOLONG;
+        } else {
+            memcpy(name, rel, len);
+            name[len] = '\0';
+            next = openat(dir_fd, name, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        if (dir_fd != root_fd) {
+            int saved = errno;
+            close(dir_fd);
+            errno = saved;
+        }
+        if (next == -1) {
+            return -1;
+        }
+        dir_fd = next;
+        rel += len + 1;
+    }
+
+    int fd = openat(dir_fd, rel, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW);
+    if (dir_fd != root_fd) {
+        int saved = errno;
+        close(dir_fd);
+        errno = saved;
+    }
+    return fd;
+}
+
+static int open_beneath(int root_fd, const char* rel) {
+    struct open_how how = {
+        .flags = O_RDONLY | O_CLOEXEC | O_NOCTTY,
+        .resolve = RESOLVE_BENEATH,
+    };
+    int fd = syscall(SYS_openat2, root_fd, rel, &how, sizeof(how));
+    if (fd == -1 && errno == ENOSYS) {
+        fd = open_walk(root_fd, rel);
+    }
+    return fd;
+}
+
+// a sidecar's tag names its coding too, so it never matches the file's
+static void format_headers(file_entry_t* entry, const char* type, bool vary) {
+    char modified[64];
+    struct tm tm;
+    gmtime_r(&entry->mtime, &tm);
+    strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    entry->etag_len = snprintf(entry->etag, sizeof(entry->etag), "\"%llx-%llx%s%s\"",
+                               (unsigned long long)entry->mtime,
+                               (unsigned long long)entry->size,
+                               entry->encoding ? "-" : "", entry->encoding ? entry->encoding : "");
+
+    // the representation's metadata comes first so a 304 can leave it out
+    size_t size = sizeof(entry->headers);
+    int n = snprintf(entry->headers, size, "Content-Type: %s\r\n", type);
+    entry->type_len = n;
+    if (entry->encoding) {
+        n += snprintf(entry->headers + n, size - n, "Content-Encoding: %s\r\n", entry->encoding);
+    }
+    entry->meta_len = n;
+    if (vary) {
+        n += snprintf(entry->headers + n, size - n, "Vary: Accept-Encoding\r\n");
+    }
+    n += snprintf(entry->headers + n, size - n,
+                  "Accept-Ranges: bytes\r\n"
+                  "Last-Modified: %s\r\n"
+                  "ETag: %s\r\n",
+                  modified, entry->etag);
+    entry->headers_len = n < (int)size ? (size_t)n : size - 1;
+}
+
+// open a regular file and watch it, the watch first so a change in between
+// still invalidates the entry
+static file_entry_t* open_file(file_cache_t* cache, const char* rel, const char* name) {
+    file_entry_t* entry = calloc(1, sizeof(file_entry_t) + strlen(name) + 1);
+    if (!entry) {
+        return NULL;
+    }
+    strcpy(entry->name, name);
+    entry->fd = -1;
+    entry->file_wd = entry->dir_wd = -1;
+
+    char full[PATH_MAX];
+    snprintf(full, sizeof(full), "%s/%s", cache->root, rel);
+    entry->file_wd = inotify_add_watch(cache->inotify_fd, full, FILE_WATCH_MASK);
+
+    entry->fd = open_beneath(cache->root_fd, rel);
+    struct stat st;
+    if (entry->fd == -1 || fstat(entry->fd, &st) == -1) {
+        goto fail;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = ENOENT;
+        goto fail;
+    }
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim.tv_sec;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->changed = st.st_ctim;
+    entry->refs = 1;
+    return entry;
+
+fail: {
+        int err = errno;
+        if (entry->fd != -1) {
+            close(entry->fd);
+        }
+        free(entry);
+        errno = err;
+        return NULL;
+    }
+}
+
+// a precompressed copy next to the file. One that can't be watched, or is
+// older than the file and so was left behind by an edit, is not used.
+static file_entry_t* load_sidecar(file_cache_t* cache, const file_entry_t* entry,
+                                  const char* rel, int encoding) {
+    char path[FILE_PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s%s", rel, encoding_suffixes[encoding]) >=
+        (int)sizeof(path)) {
+        return NULL;
+    }
+    const char* slash = strrchr(path, '/');
+    file_entry_t* sidecar = open_file(cache, path, slash ? slash + 1 : path);
+    if (!sidecar) {
+        return NULL;
+    }
+    if (sidecar->file_wd == -1 || sidecar->mtime < entry->mtime) {
+        release_watch(cache, sidecar->file_wd);
+        file_cache_release(sidecar);
+        return NULL;
+    }
+    sidecar->encoding = file_encoding_names[encoding];
+    sidecar->dir_wd = entry->dir_wd;
+    format_headers(sidecar, content_type(entry->name), true);
+    return sidecar;
+}
+
+// a file and its sidecars; the directory watch also catches sidecars that
+// appear later. Responses vary on Accept-Encoding if either kind of
+// compression can apply.
+static file_entry_t* load_entry(file_cache_t* cache, const char* rel) {
+    const char* slash = strrchr(rel, '/');
+    const char* name = slash ? slash + 1 : rel;
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/%.*s", cache->root, (int)(name - rel), rel);
+    int dir_wd = inotify_add_watch(cache->inotify_fd, dir, DIR_WATCH_MASK);
+
+    file_entry_t* entry = open_file(cache, rel, name);
+    if (!entry) {
+        return NULL;
+    }
+    entry->dir_wd = dir_wd;
+    const char* type = content_type(name);
+    entry->compressible = cache->compress_max > 0 && entry->size >= cache->compress_min &&
+                          entry->size <= cache->compress_max &&
+                          compress_type_allowed(type, strlen(type));
+    bool vary = entry->compressible;
+    for (int i = 0; i < FILE_ENCODINGS; i++) {
+        entry->encoded[i] = load_sidecar(cache, entry, rel, i);
+        vary |= entry->encoded[i] != NULL;
+    }
+    format_headers(entry, type, vary);
+    return entry;
+}
+
+// sidecars are keyed apart from the file for the hot cache; a '\n' can't
+// come from a request line
+static void key_sidecars(file_entry_t* entry) {
+    for (int i = 0; i < FILE_ENCODINGS; i++) {
+        file_entry_t* sidecar = entry->encoded[i];
+        if (!sidecar) {
+            continue;
+        }
+        size_t len = entry->key_len + 1 + strlen(sidecar->encoding);
+        sidecar->key = malloc(len + 1);
+        if (!sidecar->key) {
+            continue;
+        }
+        snprintf(sidecar->key, len + 1, "%.*s\n%s", (int)entry->key_len, entry->key,
+                 sidecar->encoding);
+        sidecar->key_len = len;
+        sidecar->hash = hash_key(sidecar->key, len);
+        sidecar->cached = true;
+    }
+}
+
+file_entry_t* file_cache_get(file_cache_t* cache, const char* path, size_t len) {
+    uint64_t hash = hash_key(path, len);
+    size_t bucket = hash & (cache->num_buckets - 1);
+    for (file_entry_t* entry = cache->buckets[bucket]; entry; entry = entry->hash_next) {
+        if (entry->key_len == len && memcmp(entry->key, path, len) == 0) {
+            entry->refs++;
+            return entry;
+        }
+    }
+
+    char rel[FILE_PATH_MAX];
+    if (!resolve_path(path, len, rel, sizeof(rel))) {
+        errno = ENOENT;
+        return NULL;
+    }
+    file_entry_t* entry = load_entry(cache, rel);
+    if (!entry) {
+        if (errno == ELOOP || errno == EXDEV || errno == ENOTDIR || errno == EISDIR) {
+            errno = ENOENT;
+        }
+        return NULL;
+    }
+
+    // without both watches a change could go unnoticed, so the file is
+    // served this once and not kept
+    entry->key = malloc(len);
+    if (!entry->key || entry->file_wd == -1 || entry->dir_wd == -1) {
+        release_watches(cache, entry);
+        return entry;
+    }
+    memcpy(entry->key, path, len);
+    entry->key_len = len;
+    entry->hash = hash;
+
+    if (cache->count == cache->max_entries) {
+        unlink_entry(cache, cache->oldest);
+    }
+    entry->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    entry->fifo_prev = cache->newest;
+    if (cache->newest) {
+        cache->newest->fifo_next = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+    entry->cached = true;
+    key_sidecars(entry);
+    entry->refs++;
+    cache->count++;
+    return entry;
+}
+
+// is a name in the entry's directory the file's or a sidecar's?
+static bool names_file(const file_entry_t* entry, const char* name) {
+    size_t len = strlen(entry->name);
+    if (strncmp(name, entry->name, len) != 0) {
+        return false;
+    }
+    if (name[len] == '\0') {
+        return true;
+    }
+    for (int i = 0; i < FILE_ENCODINGS; i++) {
+        if (strcmp(name + len, encoding_suffixes[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void file_cache_process_events(file_cache_t* cache) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t n = read(cache->inotify_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return;
+        }
+
+        for (char* p = buf; p < buf + n; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            file_entry_t* entry = cache->oldest;
+            while (entry) {
+                file_entry_t* next = entry->fifo_next;
+                bool stale;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    stale = true;   // events were lost, trust nothing
+                } else if (ev->len > 0) {
+                    stale = ev->wd == entry->dir_wd && names_file(entry, ev->name);
+                } else {
+                    stale = watches_file(entry, ev->wd);
+                }
+                if (stale) {
+                    unlink_entry(cache, entry);
+                }
+                entry = next;
+            }
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define FILE_PATH_MAX 1024
+#define FILE_HEADERS_MAX 256
+#define FILE_ENCODINGS 3            // precompressed sidecars looked for next to each file
+
+// Content-Encoding of each sidecar, indexing file_entry_t.encoded:
+// "br", "zstd" and "gzip", stored as name.br, name.zst and name.gz
+extern const char* const file_encoding_names[FILE_ENCODINGS];
+
+// an open file under the document root and the response headers that
+// depend only on it. Queued responses hold a reference, so the fd stays
+// usable after the entry is invalidated until the last of them is sent.
+// A precompressed sidecar is an entry of its own, owned by the file's.
+typedef struct file_entry {
+    struct file_entry* hash_next;
+    struct file_entry* fifo_prev;   // insertion order, for eviction
+    struct file_entry* fifo_next;
+    char* key;                      // request path it was looked up by, then
+                                    // '\n' and the coding for a sidecar
+    size_t key_len;
+    uint64_t hash;                  // of key
+    int fd;
+    off_t size;
+    time_t mtime;
+    dev_t dev;                      // which file this is, and which version of it
+    ino_t ino;
+    struct timespec changed;        // st_ctim, moves on every write or metadata change
+    char headers[FILE_HEADERS_MAX]; // Content-Type, Content-Encoding, Vary, Accept-Ranges,
+    size_t headers_len;             // Last-Modified and ETag lines, as they apply
+    size_t type_len;                // the Content-Type line, first in headers
+    size_t meta_len;                // Content-Type and Content-Encoding, which a 304 leaves out
+    char etag[48];                  // quoted, as in the ETag line
+    size_t etag_len;
+    const char* encoding;           // a sidecar's coding, NULL for the file itself
+    struct file_entry* encoded[FILE_ENCODINGS];     // the file's sidecars, NULL where none
+    bool compressible;              // type and size qualify for compression on the fly
+    int refs;
+    bool cached;                    // still in the table, or its file is
+    int file_wd;                    // inotify watches on the file and its directory
+    int dir_wd;
+    char name[];                    // file name within its directory
+} file_entry_t;
+
+// per-worker cache of open files, never shared. Entries are dropped when
+// inotify reports the file changed, was replaced or removed, and the
+// oldest one goes when the cache is full.
+typedef struct {
+    char* root;                     // resolved document root
+    int root_fd;
+    int inotify_fd;
+    file_entry_t** buckets;
+    size_t num_buckets;             // power of two
+    size_t count;
+    size_t max_entries;
+    file_entry_t* oldest;
+    file_entry_t* newest;
+    off_t compress_min;             // file sizes compressed on the fly
+    off_t compress_max;
+} file_cache_t;
+
+// files of a compressible type from compress_min to compress_max bytes
+// (none when compress_max is 0) are marked for compression on the fly and
+// vary on Accept-Encoding; returns 0 or -1 with errno set
+int file_cache_init(file_cache_t* cache, const char* root, size_t max_entries,
+                    off_t compress_min, off_t compress_max);
+void file_cache_destroy(file_cache_t* cache);
+
+// the file for a request path (not yet percent-decoded) with a reference
+// held, or NULL with errno set: ENOENT when there is no such regular file
+// under the root, including paths that try to leave it. Its sidecars are
+// found at the same time and live as long as it does.
+file_entry_t* file_cache_get(file_cache_t* cache, const char* path, size_t len);
+void file_cache_release(file_entry_t* entry);
+
+// drain pending inotify events; call when inotify_fd is readable
+void file_cache_process_events(file_cache_t* cache);
+
+#endif
@@ -0,0 +1,255 @@
+#include "hot_cache.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HOT_BUCKET_BYTES 2048       // expected bytes per object, for sizing the tables
+
+static const char status_line[] = "HTTP/1.1 200 OK\r\n";
+
+int hot_cache_init(hot_cache_t* cache, size_t capacity, size_t object_max, int num_readers) {
+    memset(cache, 0, sizeof(*cache));
+    size_t shard_capacity = capacity / HOT_SHARDS;
+    cache->object_max = object_max < shard_capacity ? object_max : shard_capacity;
+    cache->num_readers = num_readers;
+    cache->readers = aligned_alloc(POOL_CACHE_LINE, num_readers * sizeof(hot_reader_t));
+    if (!cache->readers) {
+        return -1;
+    }
+    memset(cache->readers, 0, num_readers * sizeof(hot_reader_t));
+
+    for (int i = 0; i < HOT_SHARDS; i++) {
+        hot_shard_t* shard = &cache->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->capacity = shard_capacity;
+        shard->num_buckets = 16;
+        while (shard->num_buckets * HOT_BUCKET_BYTES < shard_capacity) {
+            shard->num_buckets *= 2;
+        }
+        shard->buckets = calloc(shard->num_buckets, sizeof(hot_object_t*));
+        if (!shard->buckets) {
+            hot_cache_destroy(cache);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void hot_cache_destroy(hot_cache_t* cache) {
+    for (int i = 0; i < HOT_SHARDS; i++) {
+        hot_shard_t* shard = &cache->shards[i];
+        if (!shard->buckets) {
+            continue;
+        }
+        for (size_t b = 0; b < shard->num_buckets; b++) {
+            while (shard->buckets[b]) {
+                hot_object_t* obj = shard->buckets[b];
+                shard->buckets[b] = obj->hash_next;
+                free(obj);
+            }
+        }
+        while (shard->retired) {
+            hot_object_t* obj = shard->retired;
+            shard->retired = obj->clock_next;
+            free(obj);
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache->readers);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static hot_shard_t* shard_of(hot_cache_t* cache, uint64_t hash) {
+    return &cache->shards[(hash >> 32) & (HOT_SHARDS - 1)];
+}
+
+static bool same_file(const hot_object_t* obj, const file_entry_t* file) {
+    return obj->ino == file->ino && obj->dev == file->dev &&
+           obj->body_len == (size_t)file->size &&
+           obj->changed.tv_sec == file->changed.tv_sec &&
+           obj->changed.tv_nsec == file->changed.tv_nsec;
+}
+
+hot_object_t* hot_cache_lookup(hot_cache_t* cache, const file_entry_t* file) {
+    if (!file->cached) {
+        return NULL;
+    }
+    hot_shard_t* shard = shard_of(cache, file->hash);
+    hot_object_t* obj = __atomic_load_n(&shard->buckets[file->hash & (shard->num_buckets - 1)],
+                                        __ATOMIC_ACQUIRE);
+    for (; obj; obj = __atomic_load_n(&obj->hash_next, __ATOMIC_ACQUIRE)) {
+        if (obj->hash == file->hash && obj->key_len == file->key_len &&
+            memcmp(obj->data + obj->head_len + obj->body_len, file->key, file->key_len) == 0) {
+            if (!same_file(obj, file)) {
+                return NULL;    // the file changed; the caller refills
+            }
+            // only the first hit after the hand passed writes the shared line
+            if (!__atomic_load_n(&obj->referenced, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&obj->referenced, 1, __ATOMIC_RELAXED);
+            }
+            return obj;
+        }
+    }
+    return NULL;
+}
+
+void hot_object_hold(hot_object_t* obj) {
+    __atomic_add_fetch(&obj->refs, 1, __ATOMIC_RELAXED);
+}
+
+void hot_object_release(hot_object_t* obj) {
+    if (__atomic_sub_fetch(&obj->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(obj);
+    }
+}
+
+// take an object out of the table and the CLOCK ring; readers may still be
+// walking through it, so it only goes on the retired list. Shard lock held.
+static void retire(hot_cache_t* cache, hot_shard_t* shard, hot_object_t* obj) {
+    hot_object_t** link = &shard->buckets[obj->hash & (shard->num_buckets - 1)];
+    while (*link != obj) {
+        link = &(*link)->hash_next;
+    }
+    __atomic_store_n(link, obj->hash_next, __ATOMIC_RELEASE);
+
+    if (obj->clock_next == obj) {
+        shard->hand = NULL;
+    } else {
+        obj->clock_prev->clock_next = obj->clock_next;
+        obj->clock_next->clock_prev = obj->clock_prev;
+        if (shard->hand == obj) {
+            shard->hand = obj->clock_next;
+        }
+    }
+    shard->bytes -= obj->charge;
+
+    obj->retired_at = __atomic_add_fetch(&cache->epoch, 1, __ATOMIC_SEQ_CST);
+    obj->clock_next = shard->retired;
+    shard->retired = obj;
+}
+
+// drop the cache's reference to retired objects no reader can still have
+// found; queued responses may keep them a while longer. Shard lock held.
+static void reclaim(hot_cache_t* cache, hot_shard_t* shard) {
+    uint64_t safe = UINT64_MAX;
+    for (int i = 0; i < cache->num_readers; i++) {
+        uint64_t seen = __atomic_load_n(&cache->readers[i].seen, __ATOMIC_SEQ_CST);
+        if (seen < safe) {
+            safe = seen;
+        }
+    }
+
+    hot_object_t** link = &shard->retired;
+    while (*link) {
+        hot_object_t* obj = *link;
+        if (obj->retired_at <= safe) {
+            *link = obj->clock_next;
+            hot_object_release(obj);
+        } else {
+            link = &obj->clock_next;
+        }
+    }
+}
+
+// read the whole body with pread(); a short read means the file changed
+// since the entry was opened, and the object is not worth keeping
+static bool read_body(const file_entry_t* file, char* body) {
+    size_t done = 0;
+    while (done < (size_t)file->size) {
+        ssize_t n = pread(file->fd, body + done, file->size - done, done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+hot_object_t* hot_cache_fill(hot_cache_t* cache, const file_entry_t* file) {
+    if (!file->cached || (size_t)file->size > cache->object_max) {
+        return NULL;
+    }
+
+    size_t head_len = sizeof(status_line) - 1 + file->headers_len;
+    size_t size = head_len + file->size + file->key_len;
+    hot_object_t* obj = malloc(sizeof(hot_object_t) + size);
+    if (!obj) {
+        return NULL;
+    }
+    memcpy(obj->data, status_line, sizeof(status_line) - 1);
+    memcpy(obj->data + sizeof(status_line) - 1, file->headers, file->headers_len);
+    if (!read_body(file, obj->data + head_len)) {
+        free(obj);
+        return NULL;
+    }
+    memcpy(obj->data + head_len + file->size, file->key, file->key_len);
+    obj->hash = file->hash;
+    obj->retired_at = 0;
+    obj->refs = 1;
+    obj->referenced = 0;
+    obj->dev = file->dev;
+    obj->ino = file->ino;
+    obj->changed = file->changed;
+    obj->charge = sizeof(hot_object_t) + size;
+    obj->key_len = file->key_len;
+    obj->head_len = head_len;
+    obj->body_len = file->size;
+
+    hot_shard_t* shard = shard_of(cache, obj->hash);
+    hot_object_t** bucket = &shard->buckets[obj->hash & (shard->num_buckets - 1)];
+    pthread_mutex_lock(&shard->lock);
+
+    // an older version under the same key, or one another worker just added
+    for (hot_object_t* old = *bucket; old; old = old->hash_next) {
+        if (old->hash == obj->hash && old->key_len == obj->key_len &&
+            memcmp(old->data + old->head_len + old->body_len, file->key, file->key_len) == 0) {
+            retire(cache, shard, old);
+            break;
+        }
+    }
+
+    // CLOCK: recently hit objects get their bit cleared and another lap
+    while (shard->hand && shard->bytes + obj->charge > shard->capacity) {
+        hot_object_t* victim = shard->hand;
+        if (__atomic_load_n(&victim->referenced, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&victim->referenced, 0, __ATOMIC_RELAXED);
+            shard->hand = victim->clock_next;
+        } else {
+            retire(cache, shard, victim);
+        }
+    }
+
+    if (shard->hand) {
+        obj->clock_next = shard->hand;
+        obj->clock_prev = shard->hand->clock_prev;
+        obj->clock_prev->clock_next = obj;
+        shard->hand->clock_prev = obj;
+    } else {
+        obj->clock_next = obj->clock_prev = obj;
+        shard->hand = obj;
+    }
+    shard->bytes += obj->charge;
+    obj->hash_next = *bucket;
+    __atomic_store_n(bucket, obj, __ATOMIC_RELEASE);
+
+    reclaim(cache, shard);
+    pthread_mutex_unlock(&shard->lock);
+    return obj;
+}
+
+void hot_cache_quiescent(hot_cache_t* cache, int reader) {
+    __atomic_store_n(&cache->readers[reader].seen,
+                     __atomic_load_n(&cache->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+void hot_cache_offline(hot_cache_t* cache, int reader) {
+    __atomic_store_n(&cache->readers[reader].seen, UINT64_MAX, __ATOMIC_SEQ_CST);
+}
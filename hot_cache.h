@@ -0,0 +1,87 @@
+#ifndef HOT_CACHE_H
+#define HOT_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "file_cache.h"
+#include "pool.h"
+
+#define HOT_SHARDS 16               // power of two
+
+// a small file's whole 200 response, minus the lines that change per
+// request: status line and file headers, then the body, in one buffer.
+// Immutable once published, so any worker can read it without a lock.
+typedef struct hot_object {
+    struct hot_object* hash_next;   // read lock-free, written under the shard lock
+    struct hot_object* clock_next;  // CLOCK ring, or the retired list once unlinked
+    struct hot_object* clock_prev;
+    uint64_t hash;
+    uint64_t retired_at;            // cache epoch when it was unlinked
+    uint32_t refs;                  // the cache's own plus queued responses
+    uint8_t referenced;             // CLOCK bit, set by readers
+    dev_t dev;                      // the file version it was read from
+    ino_t ino;
+    struct timespec changed;
+    size_t charge;                  // bytes counted against the shard
+    size_t key_len;
+    size_t head_len;
+    size_t body_len;
+    char data[];                    // head, body, key
+} hot_object_t;
+
+typedef struct {
+    _Alignas(POOL_CACHE_LINE) pthread_mutex_t lock;    // writers only
+    hot_object_t** buckets;
+    size_t num_buckets;             // power of two
+    hot_object_t* hand;             // CLOCK hand; new objects go in behind it
+    size_t bytes;
+    size_t capacity;
+    hot_object_t* retired;          // unlinked, waiting out a grace period
+} hot_shard_t;
+
+// where a reader last passed a quiescent point, on a line of its own
+typedef struct {
+    _Alignas(POOL_CACHE_LINE) uint64_t seen;
+} hot_reader_t;
+
+// responses shared by every worker, sharded by key. Lookups take no lock
+// and write nothing shared unless an object's CLOCK bit needs setting;
+// inserts and evictions lock one shard. Unlinked objects are freed only
+// after every reader has passed a quiescent point (QSBR), so a pointer
+// from hot_cache_lookup() stays valid until the caller's next one.
+typedef struct {
+    hot_shard_t shards[HOT_SHARDS];
+    size_t object_max;              // largest body cached
+    uint64_t epoch;                 // bumped by every unlink
+    hot_reader_t* readers;
+    int num_readers;
+} hot_cache_t;
+
+// capacity is split evenly between the shards; returns 0 or -1
+int hot_cache_init(hot_cache_t* cache, size_t capacity, size_t object_max, int num_readers);
+// every reader must be done with the cache
+void hot_cache_destroy(hot_cache_t* cache);
+
+// the response for a file cache entry if it is cached and was read from
+// the same version of the file, else NULL
+hot_object_t* hot_cache_lookup(hot_cache_t* cache, const file_entry_t* file);
+// read a file into a new object and publish it, replacing any older one;
+// NULL if the entry can't be cached (not in the file cache, too large) or
+// the read fails. Valid until the next quiescent point, like a lookup.
+hot_object_t* hot_cache_fill(hot_cache_t* cache, const file_entry_t* file);
+
+// the reader holds no pointer it got before this call, except through
+// hot_object_hold(); call once per event loop iteration
+void hot_cache_quiescent(hot_cache_t* cache, int reader);
+// a reader that stops calling hot_cache_quiescent() (worker exit)
+void hot_cache_offline(hot_cache_t* cache, int reader);
+
+// keep an object past the next quiescent point
+void hot_object_hold(hot_object_t* obj);
+void hot_object_release(hot_object_t* obj);
+
+#endif
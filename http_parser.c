@@ -0,0 +1,618 @@
+#include "http_parser.h"
+
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+enum {
+    S_START,            // optional empty lines before the request line
+    S_METHOD,
+    S_PATH,
+    S_QUERY,
+    S_VERSION,
+    S_REQUEST_LINE_LF,
+    S_HEADER_START,
+    S_HEADER_NAME,
+    S_VALUE_START,
+    S_VALUE,
+    S_HEADER_LF,
+    S_END_LF,
+};
+
+// tchar from RFC 7230 section 3.2.6
+static const unsigned char token_chars[256] = {
+    ['0' ... '9'] = 1, ['A' ... 'Z'] = 1, ['a' ... 'z'] = 1,
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1,
+    ['+'] = 1, ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1,
+    ['~'] = 1,
+};
+
+// bytes that end (or invalidate) a run of each kind; the scanners below find
+// the first one and the state machine decides which it is
+static inline bool token_stop(unsigned char c) {
+    return !token_chars[c];
+}
+
+// request-target: anything visible (obs-text included); '?' starts the query
+static inline bool path_stop(unsigned char c) {
+    return c <= ' ' || c == 0x7f || c == '?';
+}
+
+static inline bool query_stop(unsigned char c) {
+    return c <= ' ' || c == 0x7f;
+}
+
+// field-value: visible, obs-text, SP and HTAB; CR ends it
+static inline bool value_stop(unsigned char c) {
+    return (c < ' ' && c != '\t') || c == 0x7f;
+}
+
+typedef size_t (*scan_fn)(const char* buf, size_t pos, size_t limit);
+
+typedef struct {
+    scan_fn token;
+    scan_fn path;
+    scan_fn query;
+    scan_fn value;
+} scanners_t;
+
+#define DEFINE_SCALAR_SCANNER(kind)                                                 \
+    static size_t scan_##kind##_scalar(const char* buf, size_t pos, size_t limit) { \
+        while (pos < limit && !kind##_stop((unsigned char)buf[pos])) pos++;          \
+        return pos;                                                                 \
+    }
+
+DEFINE_SCALAR_SCANNER(token)
+DEFINE_SCALAR_SCANNER(path)
+DEFINE_SCALAR_SCANNER(query)
+DEFINE_SCALAR_SCANNER(value)
+
+#ifdef HAVE_X86_SIMD
+
+// pcmpestri byte ranges matching the stop bytes. Tokens need ten ranges
+// but the instruction takes eight, so '|' and '~' are matched too and
+// skipped by the exact check in the scanner loop.
+static const char token_ranges[16] __attribute__((aligned(16))) =
+    "\x00 \"\"(),,//:@[]{\xff";
+static const char path_ranges[16] __attribute__((aligned(16))) = "\x00 ??\x7f\x7f";
+static const char query_ranges[16] __attribute__((aligned(16))) = "\x00 \x7f\x7f";
+static const char value_ranges[16] __attribute__((aligned(16))) = "\x00\x08\x0a\x1f\x7f\x7f";
+
+// first candidate stop byte at or after pos; if none is found in the whole
+// 16-byte blocks, the start of the remaining tail
+__attribute__((target("sse4.2")))
+static inline size_t find_ranges_sse42(const char* buf, size_t pos, size_t limit,
+                                       const char* ranges, int ranges_len) {
+    __m128i r = _mm_load_si128((const __m128i*)ranges);
+    while (pos + 16 <= limit) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(buf + pos));
+        int idx = _mm_cmpestri(r, ranges_len, b, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx != 16) {
+            return pos + idx;
+        }
+        pos += 16;
+    }
+    return pos;
+}
+
+// scan 16 bytes at a time, confirming each candidate with the exact check
+#define DEFINE_RANGE_SCANNER(kind, ranges_len, isa, target_isa)                          \
+    __attribute__((target(target_isa)))                                                  \
+    static size_t scan_##kind##_##isa(const char* buf, size_t pos, size_t limit) {      \
+        for (;;) {                                                                       \
+            pos = find_ranges_sse42(buf, pos, limit, kind##_ranges, ranges_len);         \
+            if (pos == limit || kind##_stop((unsigned char)buf[pos])) {                  \
+                return pos;                                                              \
+            }                                                                            \
+            pos++;                                                                       \
+        }                                                                                \
+    }
+
+DEFINE_RANGE_SCANNER(token, 16, sse42, "sse4.2")
+DEFINE_RANGE_SCANNER(path, 6, sse42, "sse4.2")
+DEFINE_RANGE_SCANNER(query, 4, sse42, "sse4.2")
+DEFINE_RANGE_SCANNER(value, 6, sse42, "sse4.2")
+
+// the token set doesn't fit a compare chain, so the AVX2 level keeps the
+// range scan for header names and methods, just VEX encoded
+DEFINE_RANGE_SCANNER(token, 16, avx2, "avx2")
+
+// AVX2: exact stop-byte masks from byte compares. The compares are signed,
+// so bytes >= 0x80 are negative and never count as control bytes. A tail
+// of 16-31 bytes uses the same compares on one 128-bit block, VEX encoded
+// under this target so there is no SSE/AVX transition on short values.
+#define DEFINE_AVX2_MASKS(bits, vec, op)                                                 \
+    __attribute__((target("avx2")))                                                      \
+    static inline vec control_mask_##bits(vec b, char below) {                           \
+        vec non_negative = op##_cmpgt_epi8(b, op##_set1_epi8(-1));                       \
+        vec small = op##_cmpgt_epi8(op##_set1_epi8(below), b);                           \
+        vec del = op##_cmpeq_epi8(b, op##_set1_epi8(0x7f));                              \
+        return op##_or_si##bits(op##_and_si##bits(non_negative, small), del);            \
+    }                                                                                    \
+    __attribute__((target("avx2")))                                                      \
+    static inline unsigned path_mask_##bits(vec b) {                                     \
+        vec m = control_mask_##bits(b, ' ' + 1);                                         \
+        m = op##_or_si##bits(m, op##_cmpeq_epi8(b, op##_set1_epi8('?')));                \
+        return (unsigned)op##_movemask_epi8(m);                                          \
+    }                                                                                    \
+    __attribute__((target("avx2")))                                                      \
+    static inline unsigned query_mask_##bits(vec b) {                                    \
+        return (unsigned)op##_movemask_epi8(control_mask_##bits(b, ' ' + 1));            \
+    }                                                                                    \
+    __attribute__((target("avx2")))                                                      \
+    static inline unsigned value_mask_##bits(vec b) {                                    \
+        vec m = control_mask_##bits(b, ' ');                                             \
+        m = op##_andnot_si##bits(op##_cmpeq_epi8(b, op##_set1_epi8('\t')), m);           \
+        return (unsigned)op##_movemask_epi8(m);                                          \
+    }
+
+DEFINE_AVX2_MASKS(256, __m256i, _mm256)
+DEFINE_AVX2_MASKS(128, __m128i, _mm)
+
+#define DEFINE_AVX2_SCANNER(kind)                                                        \
+    __attribute__((target("avx2")))                                                      \
+    static size_t scan_##kind##_avx2(const char* buf, size_t pos, size_t limit) {       \
+        while (pos + 32 <= limit) {                                                      \
+            unsigned mask = kind##_mask_256(_mm256_loadu_si256((const __m256i*)(buf + pos))); \
+            if (mask) {                                                                  \
+                return pos + __builtin_ctz(mask);                                        \
+            }                                                                            \
+            pos += 32;                                                                   \
+        }                                                                                \
+        if (pos + 16 <= limit) {                                                         \
+            unsigned mask = kind##_mask_128(_mm_loadu_si128((const __m128i*)(buf + pos))); \
+            if (mask) {                                                                  \
+                return pos + __builtin_ctz(mask);                                        \
+            }                                                                            \
+            pos += 16;                                                                   \
+        }                                                                                \
+        return scan_##kind##_scalar(buf, pos, limit);                                    \
+    }
+
+DEFINE_AVX2_SCANNER(path)
+DEFINE_AVX2_SCANNER(query)
+DEFINE_AVX2_SCANNER(value)
+
+#endif
+
+static const scanners_t scalar_scanners = {
+    scan_token_scalar, scan_path_scalar, scan_query_scalar, scan_value_scalar
+};
+
+#ifdef HAVE_X86_SIMD
+static const scanners_t sse42_scanners = {
+    scan_token_sse42, scan_path_sse42, scan_query_sse42, scan_value_sse42
+};
+
+static const scanners_t avx2_scanners = {
+    scan_token_avx2, scan_path_avx2, scan_query_avx2, scan_value_avx2
+};
+#endif
+
+static const scanners_t* scanners = &scalar_scanners;
+static http_simd_t simd_level = HTTP_SIMD_SCALAR;
+
+static bool cpu_supports(http_simd_t level) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    switch (level) {
+    case HTTP_SIMD_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2");
+    case HTTP_SIMD_SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    default:
+        return true;
+    }
+#else
+    return level == HTTP_SIMD_SCALAR;
+#endif
+}
+
+bool http_parser_set_simd_level(http_simd_t level) {
+    if (!cpu_supports(level)) {
+        return false;
+    }
+    switch (level) {
+#ifdef HAVE_X86_SIMD
+    case HTTP_SIMD_AVX2:
+        scanners = &avx2_scanners;
+        break;
+    case HTTP_SIMD_SSE42:
+        scanners = &sse42_scanners;
+        break;
+#endif
+    default:
+        scanners = &scalar_scanners;
+        break;
+    }
+    simd_level = level;
+    return true;
+}
+
+http_simd_t http_parser_simd_level(void) {
+    return simd_level;
+}
+
+const char* http_simd_name(http_simd_t level) {
+    switch (level) {
+    case HTTP_SIMD_AVX2:
+        return "avx2";
+    case HTTP_SIMD_SSE42:
+        return "sse4.2";
+    default:
+        return "scalar";
+    }
+}
+
+// runtime dispatch: pick the widest scanner before main() runs
+__attribute__((constructor))
+static void select_scanners(void) {
+    if (!http_parser_set_simd_level(HTTP_SIMD_AVX2)) {
+        http_parser_set_simd_level(HTTP_SIMD_SSE42);
+    }
+}
+
+static inline http_slice_t make_slice(const char* buf, const uint32_t range[2]) {
+    return (http_slice_t){ .ptr = buf + range[0], .len = range[1] };
+}
+
+static void parser_reset(http_parser_t* parser) {
+    parser->state = S_START;
+    parser->version_pos = 0;
+    parser->pos = 0;
+    parser->mark = 0;
+    parser->num_headers = 0;
+}
+
+void http_parser_init(http_parser_t* parser, size_t max_head_size, size_t max_headers) {
+    memset(parser, 0, sizeof(*parser));
+    parser->max_head_size = max_head_size > UINT32_MAX ? UINT32_MAX : (uint32_t)max_head_size;
+    parser->max_headers = max_headers > HTTP_MAX_HEADERS ? HTTP_MAX_HEADERS : (uint32_t)max_headers;
+    parser_reset(parser);
+}
+
+static void fill_request(const http_parser_t* parser, const char* buf, size_t head_len, http_request_t* req) {
+    req->method = make_slice(buf, parser->method);
+    req->path = make_slice(buf, parser->path);
+    req->query = make_slice(buf, parser->query);
+    req->minor_version = parser->minor_version;
+    req->num_headers = parser->num_headers;
+    for (uint32_t i = 0; i < parser->num_headers; i++) {
+        const uint32_t* h = parser->headers[i];
+        req->headers[i].name = (http_slice_t){ .ptr = buf + h[0], .len = h[1] };
+        req->headers[i].value = (http_slice_t){ .ptr = buf + h[2], .len = h[3] };
+    }
+    req->header_len = head_len;
+}
+
+http_parse_result_t http_parse_request(http_parser_t* parser, const char* buf, size_t len,
+                                       http_request_t* req) {
+    static const char version_prefix[] = "HTTP/1.";
+    size_t pos = parser->pos;
+    size_t limit = len;
+    bool truncated = false;
+
+    if (limit > parser->max_head_size) {
+        limit = parser->max_head_size;
+        truncated = true;
+    }
+
+    while (pos < limit) {
+        unsigned char c = buf[pos];
+
+        switch (parser->state) {
+        case S_START:
+            if (c == '\r' || c == '\n') {
+                pos++;
+                break;
+            }
+            parser->mark = pos;
+            parser->state = S_METHOD;
+            break;
+
+        case S_METHOD:
+            pos = scanners->token(buf, pos, limit);
+            if (pos == limit) break;
+            if (buf[pos] != ' ' || pos == parser->mark) return HTTP_PARSE_BAD_REQUEST;
+            parser->method[0] = parser->mark;
+            parser->method[1] = pos - parser->mark;
+            parser->mark = ++pos;
+            parser->state = S_PATH;
+            break;
+
+        case S_PATH:
+            pos = scanners->path(buf, pos, limit);
+            if (pos == limit) break;
+            c = buf[pos];
+            if ((c != ' ' && c != '?') || pos == parser->mark) return HTTP_PARSE_BAD_REQUEST;
+            parser->path[0] = parser->mark;
+            parser->path[1] = pos - parser->mark;
+            parser->query[0] = pos + 1;
+            parser->query[1] = 0;
+            parser->mark = ++pos;
+            parser->state = c == '?' ? S_QUERY : S_VERSION;
+            break;
+
+        case S_QUERY:
+            pos = scanners->query(buf, pos, limit);
+            if (pos == limit) break;
+            if (buf[pos] != ' ') return HTTP_PARSE_BAD_REQUEST;
+            parser->query[1] = pos - parser->mark;
+            pos++;
+            parser->state = S_VERSION;
+            break;
+
+        case S_VERSION:
+            if (parser->version_pos < sizeof(version_prefix) - 1) {
+                if (c != version_prefix[parser->version_pos]) {
+                    // "HTTP/" followed by another major version is well formed but unsupported
+                    return parser->version_pos == 5 && c >= '0' && c <= '9'
+                               ? HTTP_PARSE_BAD_VERSION : HTTP_PARSE_BAD_REQUEST;
+                }
+            } else if (parser->version_pos == sizeof(version_prefix) - 1) {
+                if (c < '0' || c > '9') return HTTP_PARSE_BAD_REQUEST;
+                if (c > '1') return HTTP_PARSE_BAD_VERSION;
+                parser->minor_version = c - '0';
+            } else {
+                if (c != '\r') return HTTP_PARSE_BAD_REQUEST;
+                parser->state = S_REQUEST_LINE_LF;
+            }
+            parser->version_pos++;
+            pos++;
+            break;
+
+        case S_REQUEST_LINE_LF:
+        case S_HEADER_LF:
+            if (c != '\n') return HTTP_PARSE_BAD_REQUEST;
+            pos++;
+            parser->state = S_HEADER_START;
+            break;
+
+        case S_HEADER_START:
+            if (c == '\r') {
+                pos++;
+                parser->state = S_END_LF;
+                break;
+            }
+            // obs-fold continuation lines land here too and are rejected
+            if (!token_chars[c]) return HTTP_PARSE_BAD_REQUEST;
+            if (parser->num_headers == parser->max_headers) return HTTP_PARSE_TOO_MANY_HEADERS;
+            parser->mark = pos;
+            parser->state = S_HEADER_NAME;
+            break;
+
+        case S_HEADER_NAME:
+            pos = scanners->token(buf, pos, limit);
+            if (pos == limit) break;
+            if (buf[pos] != ':') return HTTP_PARSE_BAD_REQUEST;
+            parser->name[0] = parser->mark;
+            parser->name[1] = pos - parser->mark;
+            pos++;
+            parser->state = S_VALUE_START;
+            break;
+
+        case S_VALUE_START:
+            if (c == ' ' || c == '\t') {
+                pos++;
+                break;
+            }
+            parser->mark = pos;
+            parser->state = S_VALUE;
+            break;
+
+        case S_VALUE: {
+            pos = scanners->value(buf, pos, limit);
+            if (pos == limit) break;
+            if (buf[pos] != '\r') return HTTP_PARSE_BAD_REQUEST;
+
+            size_t end = pos;
+            while (end > parser->mark && (buf[end - 1] == ' ' || buf[end - 1] == '\t')) end--;
+            uint32_t* h = parser->headers[parser->num_headers++];
+            h[0] = parser->name[0];
+            h[1] = parser->name[1];
+            h[2] = parser->mark;
+            h[3] = end - parser->mark;
+            pos++;
+            parser->state = S_HEADER_LF;
+            break;
+        }
+
+        case S_END_LF:
+            if (c != '\n') return HTTP_PARSE_BAD_REQUEST;
+            fill_request(parser, buf, pos + 1, req);
+            parser_reset(parser);
+            return HTTP_PARSE_DONE;
+        }
+    }
+
+    parser->pos = pos;
+    return truncated ? HTTP_PARSE_HEAD_TOO_LARGE : HTTP_PARSE_INCOMPLETE;
+}
+
+enum {
+    B_LENGTH,           // Content-Length framing
+    B_SIZE_START,       // chunk-size needs at least one hex digit
+    B_SIZE,
+    B_EXT,              // chunk extensions, skipped
+    B_SIZE_LF,
+    B_DATA,
+    B_DATA_CR,
+    B_DATA_LF,
+    B_TRAILER_START,    // a trailer field, or the empty line ending the body
+    B_TRAILER,          // skipped
+    B_TRAILER_LF,
+    B_END_LF,
+    B_DONE,
+};
+
+static int hex_value(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+void http_body_init(http_body_t* body, bool chunked, uint64_t length) {
+    body->state = chunked ? B_SIZE_START : B_LENGTH;
+    body->line_len = 0;
+    body->remaining = chunked ? 0 : length;
+}
+
+http_body_result_t http_body_decode(http_body_t* body, const char* buf, size_t len,
+                                    size_t* consumed, http_slice_t* data) {
+    *consumed = 0;
+    if (body->state == B_DONE || (body->state == B_LENGTH && body->remaining == 0)) {
+        body->state = B_DONE;
+        return HTTP_BODY_DONE;
+    }
+    if (body->state == B_LENGTH) {
+        size_t take = len < body->remaining ? len : body->remaining;
+        body->remaining -= take;
+        *data = (http_slice_t){ .ptr = buf, .len = take };
+        *consumed = take;
+        return take > 0 ? HTTP_BODY_DATA : HTTP_BODY_INCOMPLETE;
+    }
+
+    size_t pos = 0;
+    while (pos < len) {
+        unsigned char c = buf[pos];
+
+        switch (body->state) {
+        case B_SIZE_START:
+        case B_SIZE: {
+            if (++body->line_len > HTTP_BODY_LINE_MAX) return HTTP_BODY_BAD;
+            int digit = hex_value(c);
+            if (digit >= 0) {
+                if (body->remaining >> 59) return HTTP_BODY_BAD;   // would overflow
+                body->remaining = body->remaining * 16 + digit;
+                body->state = B_SIZE;
+            } else if (body->state == B_SIZE_START) {
+                return HTTP_BODY_BAD;
+            } else if (c == ';' || c == ' ' || c == '\t') {
+                body->state = B_EXT;
+            } else if (c == '\r') {
+                body->state = B_SIZE_LF;
+            } else {
+                return HTTP_BODY_BAD;
+            }
+            pos++;
+            break;
+        }
+
+        case B_EXT:
+            if (c == '\n' || ++body->line_len > HTTP_BODY_LINE_MAX) return HTTP_BODY_BAD;
+            if (c == '\r') body->state = B_SIZE_LF;
+            pos++;
+            break;
+
+        case B_SIZE_LF:
+            if (c != '\n') return HTTP_BODY_BAD;
+            body->line_len = 0;
+            body->state = body->remaining > 0 ? B_DATA : B_TRAILER_START;
+            pos++;
+            break;
+
+        case B_DATA: {
+            size_t take = len - pos < body->remaining ? len - pos : body->remaining;
+            body->remaining -= take;
+            if (body->remaining == 0) body->state = B_DATA_CR;
+            *data = (http_slice_t){ .ptr = buf + pos, .len = take };
+            *consumed = pos + take;
+            return HTTP_BODY_DATA;
+        }
+
+        case B_DATA_CR:
+            if (c != '\r') return HTTP_BODY_BAD;
+            body->state = B_DATA_LF;
+            pos++;
+            break;
+
+        case B_DATA_LF:
+            if (c != '\n') return HTTP_BODY_BAD;
+            body->state = B_SIZE_START;
+            pos++;
+            break;
+
+        case B_TRAILER_START:
+            if (c == '\r') {
+                body->state = B_END_LF;
+                pos++;
+            } else {
+                body->state = B_TRAILER;
+            }
+            break;
+
+        case B_TRAILER:
+            if (c == '\n' || ++body->line_len > HTTP_BODY_LINE_MAX) return HTTP_BODY_BAD;
+            if (c == '\r') body->state = B_TRAILER_LF;
+            pos++;
+            break;
+
+        case B_TRAILER_LF:
+            if (c != '\n') return HTTP_BODY_BAD;
+            body->state = B_TRAILER_START;
+            pos++;
+            break;
+
+        case B_END_LF:
+            if (c != '\n') return HTTP_BODY_BAD;
+            body->state = B_DONE;
+            *consumed = pos + 1;
+            return HTTP_BODY_DONE;
+        }
+    }
+
+    *consumed = pos;
+    return HTTP_BODY_INCOMPLETE;
+}
+
+uint64_t http_body_unframed(const http_body_t* body) {
+    return body->state == B_LENGTH ? body->remaining : 0;
+}
+
+void http_body_skip(http_body_t* body, uint64_t n) {
+    body->remaining -= n;
+}
+
+bool http_slice_eq(http_slice_t slice, const char* str) {
+    size_t len = strlen(str);
+    return slice.len == len && memcmp(slice.ptr, str, len) == 0;
+}
+
+bool http_slice_case_eq(http_slice_t slice, const char* str) {
+    size_t len = strlen(str);
+    return slice.len == len && strncasecmp(slice.ptr, str, len) == 0;
+}
+
+const http_slice_t* http_find_header(const http_request_t* req, const char* name) {
+    for (size_t i = 0; i < req->num_headers; i++) {
+        if (http_slice_case_eq(req->headers[i].name, name)) {
+            return &req->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+bool http_header_has_token(http_slice_t value, const char* token) {
+    size_t token_len = strlen(token);
+    const char* s = value.ptr;
+    size_t len = value.len;
+    size_t i = 0;
+
+    while (i < len) {
+        while (i < len && (s[i] == ' ' || s[i] == '\t' || s[i] == ',')) i++;
+        size_t start = i;
+        while (i < len && s[i] != ',') i++;
+        size_t end = i;
+        while (end > start && (s[end - 1] == ' ' || s[end - 1] == '\t')) end--;
+        if (end - start == token_len && strncasecmp(s + start, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
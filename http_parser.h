@@ -0,0 +1,124 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_MAX_HEADERS 64
+
+// a view into the caller's buffer; never NUL terminated
+typedef struct {
+    const char* ptr;
+    size_t len;
+} http_slice_t;
+
+typedef struct {
+    http_slice_t name;
+    http_slice_t value;
+} http_header_t;
+
+typedef struct {
+    http_slice_t method;
+    http_slice_t path;          // target up to '?'
+    http_slice_t query;         // after '?', empty if there is none
+    int minor_version;          // HTTP/1.x
+    http_header_t headers[HTTP_MAX_HEADERS];
+    size_t num_headers;
+    size_t header_len;          // request line and headers, including the blank line
+} http_request_t;
+
+typedef enum {
+    HTTP_PARSE_DONE = 1,
+    HTTP_PARSE_INCOMPLETE = 0,
+    HTTP_PARSE_BAD_REQUEST = -1,
+    HTTP_PARSE_HEAD_TOO_LARGE = -2,
+    HTTP_PARSE_TOO_MANY_HEADERS = -3,
+    HTTP_PARSE_BAD_VERSION = -4,
+} http_parse_result_t;
+
+// delimiter scanning implementation; the best one the CPU supports is picked
+// at startup
+typedef enum {
+    HTTP_SIMD_SCALAR,
+    HTTP_SIMD_SSE42,            // 16 bytes per step with pcmpestri ranges
+    HTTP_SIMD_AVX2,             // 32 bytes per step with compare + movemask
+} http_simd_t;
+
+// resumable parser state; everything is kept as offsets from the start of the
+// request, so the buffer holding it may move (realloc, compaction) between calls
+typedef struct {
+    uint8_t state;
+    uint8_t version_pos;
+    uint32_t pos;               // bytes of the head consumed so far
+    uint32_t mark;              // start of the token being parsed
+    uint32_t method[2];         // offset, length
+    uint32_t path[2];
+    uint32_t query[2];
+    uint32_t name[2];           // header currently being parsed
+    uint32_t headers[HTTP_MAX_HEADERS][4];
+    uint32_t num_headers;
+    uint32_t max_head_size;
+    uint32_t max_headers;
+    int minor_version;
+} http_parser_t;
+
+// limits: max_head_size bytes of request line plus headers, max_headers
+// header lines (capped at HTTP_MAX_HEADERS)
+void http_parser_init(http_parser_t* parser, size_t max_head_size, size_t max_headers);
+
+// continue parsing the request whose first byte is at buf[0]; len is all that
+// has arrived so far, and the bytes already seen must be unchanged. On
+// HTTP_PARSE_DONE req is filled with slices into buf and the parser is reset
+// for the next request. Nothing is copied and nothing is allocated.
+http_parse_result_t http_parse_request(http_parser_t* parser, const char* buf, size_t len,
+                                       http_request_t* req);
+
+// request body framing: Content-Length, or chunked with extensions and
+// trailers skipped. State is kept between calls, never the bytes, so the
+// body can be decoded as it arrives and its buffer reused.
+typedef struct {
+    uint8_t state;
+    uint32_t line_len;          // of the chunk size line, or of all trailers
+    uint64_t remaining;         // of the body, or of the current chunk
+} http_body_t;
+
+typedef enum {
+    HTTP_BODY_DATA = 2,         // data holds body bytes; call again for the rest
+    HTTP_BODY_DONE = 1,
+    HTTP_BODY_INCOMPLETE = 0,   // all of buf was framing or data; more is needed
+    HTTP_BODY_BAD = -1,         // malformed chunked framing
+} http_body_result_t;
+
+#define HTTP_BODY_LINE_MAX 4096     // bytes of chunk size line or trailers allowed
+
+void http_body_init(http_body_t* body, bool chunked, uint64_t length);
+
+// continue decoding the body at buf[0]; *consumed is how many of the len
+// bytes were used. Bytes after the body are left alone, so the next
+// request can follow it in the same buffer.
+http_body_result_t http_body_decode(http_body_t* body, const char* buf, size_t len,
+                                    size_t* consumed, http_slice_t* data);
+
+// how much of a Content-Length body is still to come: bytes the caller may
+// move without decoding (e.g. with splice()) and then pass to
+// http_body_skip(). Always 0 for chunked bodies.
+uint64_t http_body_unframed(const http_body_t* body);
+void http_body_skip(http_body_t* body, uint64_t n);
+
+http_simd_t http_parser_simd_level(void);
+const char* http_simd_name(http_simd_t level);
+
+// force a scanning implementation (for benchmarks); false if the CPU lacks it
+bool http_parser_set_simd_level(http_simd_t level);
+
+bool http_slice_eq(http_slice_t slice, const char* str);
+bool http_slice_case_eq(http_slice_t slice, const char* str);
+
+// first header named name (case-insensitive), or NULL
+const http_slice_t* http_find_header(const http_request_t* req, const char* name);
+
+// does a comma separated header value contain token (case-insensitive)?
+bool http_header_has_token(http_slice_t value, const char* token);
+
+#endif
@@ -0,0 +1,270 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SLOTS 1024         // per thread, power of two
+#define LOG_MSG_SIZE 232            // longer messages are truncated
+#define MAX_LOG_RINGS 64
+#define LOG_BATCH_SIZE (64 * 1024)  // bytes written per write(2) by the drainer
+#define LOG_IDLE_SLEEP_NS 2000000   // drainer backoff when every ring is empty
+#define CACHE_LINE 64
+
+typedef struct {
+    struct timespec ts;
+    int level;
+    unsigned len;
+    char msg[LOG_MSG_SIZE];
+} log_record_t;
+
+// single producer (the owning thread), single consumer (the drainer); head
+// and tail live on separate cache lines so the two sides don't false-share
+typedef struct {
+    _Alignas(CACHE_LINE) uint64_t head;
+    _Alignas(CACHE_LINE) uint64_t tail;
+    _Alignas(CACHE_LINE) uint64_t dropped;
+    uint64_t dropped_reported;      // drainer only
+    char name[16];
+    log_record_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+typedef struct {
+    int fd;
+    size_t len;
+    char data[LOG_BATCH_SIZE];
+} log_batch_t;
+
+int log_level = LOG_LEVEL_INFO;
+
+static log_ring_t* rings[MAX_LOG_RINGS];
+static int num_rings = 0;
+static __thread log_ring_t* thread_ring;
+static __thread char thread_name[16];     // from log_thread_init(), even without a ring
+
+static pthread_t drain_thread;
+static bool drain_started = false;
+static volatile bool drain_stop = false;
+
+static const char* const level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+int log_level_from_name(const char* name) {
+    static const char* const names[] = { "error", "warn", "info", "debug" };
+    for (int i = 0; i < 4; i++) {
+        if (strcasecmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// "HH:MM:SS.mmm LEVEL [thread] message\n"
+static size_t format_record(char* out, size_t size, const struct timespec* ts, int level,
+                            const char* thread, const char* msg, size_t msg_len) {
+    struct tm tm;
+    localtime_r(&ts->tv_sec, &tm);
+    int n = snprintf(out, size, "%02d:%02d:%02d.%03ld %-5s [%s] %.*s\n",
+                     tm.tm_hour, tm.tm_min, tm.tm_sec, ts->tv_nsec / 1000000,
+                     level_names[level], thread, (int)msg_len, msg);
+    if (n < 0) {
+        return 0;
+    }
+    return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+static void write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void batch_flush(log_batch_t* batch) {
+    write_all(batch->fd, batch->data, batch->len);
+    batch->len = 0;
+}
+
+static void batch_append(log_batch_t* batch, const struct timespec* ts, int level,
+                         const char* thread, const char* msg, size_t msg_len) {
+    if (batch->len + LOG_MSG_SIZE + 64 > sizeof(batch->data)) {
+        batch_flush(batch);
+    }
+    batch->len += format_record(batch->data + batch->len, sizeof(batch->data) - batch->len,
+                                ts, level, thread, msg, msg_len);
+}
+
+void log_write(int level, const char* fmt, ...) {
+    log_ring_t* ring = thread_ring;
+    va_list args;
+
+    if (!ring) {
+        // no ring on this thread: format and write synchronously
+        char msg[LOG_MSG_SIZE];
+        char line[LOG_MSG_SIZE + 64];
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        va_start(args, fmt);
+        int n = vsnprintf(msg, sizeof(msg), fmt, args);
+        va_end(args);
+        size_t msg_len = n < 0 ? 0 : ((size_t)n < sizeof(msg) ? (size_t)n : sizeof(msg) - 1);
+        size_t len = format_record(line, sizeof(line), &ts, level, thread_name, msg, msg_len);
+        write_all(level <= LOG_LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO, line, len);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == LOG_RING_SLOTS) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    log_record_t* rec = &ring->slots[head & (LOG_RING_SLOTS - 1)];
+    clock_gettime(CLOCK_REALTIME_COARSE, &rec->ts);
+    rec->level = level;
+    va_start(args, fmt);
+    int n = vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+    va_end(args);
+    rec->len = n < 0 ? 0 : ((size_t)n < sizeof(rec->msg) ? (unsigned)n : sizeof(rec->msg) - 1);
+
+    // strip one trailing newline, the formatter adds its own
+    if (rec->len > 0 && rec->msg[rec->len - 1] == '\n') {
+        rec->len--;
+    }
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// move everything currently in the rings to the output batches
+// returns the number of records drained
+static size_t drain_rings(log_batch_t* out, log_batch_t* err) {
+    size_t drained = 0;
+    int count = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; i++) {
+        log_ring_t* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (!ring) {
+            continue;
+        }
+
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++) {
+            const log_record_t* rec = &ring->slots[tail & (LOG_RING_SLOTS - 1)];
+            batch_append(rec->level <= LOG_LEVEL_WARN ? err : out,
+                         &rec->ts, rec->level, ring->name, rec->msg, rec->len);
+            drained++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != ring->dropped_reported) {
+            char msg[96];
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            int n = snprintf(msg, sizeof(msg), "log ring full, dropped %llu messages",
+                             (unsigned long long)(dropped - ring->dropped_reported));
+            batch_append(err, &ts, LOG_LEVEL_WARN, ring->name, msg, n);
+            ring->dropped_reported = dropped;
+        }
+    }
+    return drained;
+}
+
+static void* drain_main(void* arg) {
+    (void)arg;
+    static log_batch_t out = { .fd = STDOUT_FILENO };
+    static log_batch_t err = { .fd = STDERR_FILENO };
+
+    for (;;) {
+        bool stopping = drain_stop;
+        size_t drained = drain_rings(&out, &err);
+        batch_flush(&err);
+        batch_flush(&out);
+
+        if (drained == 0) {
+            // the stop flag was read before this pass, so nothing logged
+            // before log_shutdown() was called can be left behind
+            if (stopping) {
+                break;
+            }
+            struct timespec idle = { .tv_sec = 0, .tv_nsec = LOG_IDLE_SLEEP_NS };
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+void log_init(int level) {
+    log_level = level;
+    if (pthread_create(&drain_thread, NULL, drain_main, NULL) != 0) {
+        perror("pthread_create log");
+        return;
+    }
+    drain_started = true;
+}
+
+void log_thread_init(const char* name) {
+    snprintf(thread_name, sizeof(thread_name), "%s", name);
+    if (!drain_started || thread_ring) {
+        return;
+    }
+
+    log_ring_t* ring = aligned_alloc(CACHE_LINE, sizeof(log_ring_t));
+    if (!ring) {
+        return;
+    }
+    memset(ring, 0, sizeof(*ring));
+    memcpy(ring->name, thread_name, sizeof(ring->name));
+
+    int index = __atomic_fetch_add(&num_rings, 1, __ATOMIC_ACQ_REL);
+    if (index >= MAX_LOG_RINGS) {
+        __atomic_fetch_sub(&num_rings, 1, __ATOMIC_ACQ_REL);
+        free(ring);
+        return;
+    }
+    __atomic_store_n(&rings[index], ring, __ATOMIC_RELEASE);
+    thread_ring = ring;
+}
+
+uint64_t log_dropped_total(void) {
+    uint64_t total = 0;
+    int count = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        log_ring_t* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (ring) {
+            total += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        }
+    }
+    return total;
+}
+
+// drain what is left and stop the background thread; call after every
+// logging thread but the caller has exited
+void log_shutdown(void) {
+    if (!drain_started) {
+        return;
+    }
+    drain_stop = true;
+    pthread_join(drain_thread, NULL);
+    drain_started = false;
+
+    int count = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        free(rings[i]);
+        rings[i] = NULL;
+    }
+    num_rings = 0;
+    thread_ring = NULL;
+}
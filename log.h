@@ -0,0 +1,52 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+// messages above this level are compiled out entirely
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// runtime threshold, checked before any formatting happens
+extern int log_level;
+
+// logging is asynchronous: each thread that calls log_thread_init() gets its
+// own single-producer ring, and a background thread drains all rings to
+// stdout (info, debug) and stderr (warnings, errors). When a ring is full the
+// message is dropped and counted instead of blocking the caller. Threads
+// without a ring (none set up yet, or no room for one) write synchronously,
+// under the name passed to log_thread_init() if they called it.
+void log_init(int level);
+void log_thread_init(const char* name);
+void log_shutdown(void);
+uint64_t log_dropped_total(void);
+
+// "error", "warn", "info" or "debug"; -1 if unknown
+int log_level_from_name(const char* name);
+
+void log_write(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_at(level, ...)                                               \
+    do {                                                                 \
+        if ((level) <= LOG_COMPILE_LEVEL && (level) <= log_level) {      \
+            log_write((level), __VA_ARGS__);                             \
+        }                                                                \
+    } while (0)
+
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(...) log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// perror() through the log
+#define log_errno(what) log_error("%s: %s", (what), strerror(errno))
+
+#endif
@@ -0,0 +1,146 @@
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+static worker_metrics_t* blocks;
+static int num_blocks;
+
+int metrics_init(int num_workers) {
+    blocks = aligned_alloc(METRICS_CACHE_LINE, num_workers * sizeof(worker_metrics_t));
+    if (!blocks) {
+        return -1;
+    }
+    memset(blocks, 0, num_workers * sizeof(worker_metrics_t));
+    num_blocks = num_workers;
+    return 0;
+}
+
+void metrics_free(void) {
+    free(blocks);
+    blocks = NULL;
+    num_blocks = 0;
+}
+
+worker_metrics_t* metrics_worker(int worker_id) {
+    return &blocks[worker_id];
+}
+
+static uint64_t load(const uint64_t* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void render_counter(arena_str_t* out, const char* name, const char* help, size_t offset) {
+    arena_printf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (int i = 0; i < num_blocks; i++) {
+        const uint64_t* value = (const uint64_t*)((const char*)&blocks[i] + offset);
+        arena_printf(out, "%s{worker=\"%d\"} %llu\n", name, i, (unsigned long long)load(value));
+    }
+}
+
+// one series per worker and pool, labelled with the pool's object size
+static void render_pools(arena_str_t* out, const char* name, const char* type, const char* help,
+                         size_t offset) {
+    arena_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    for (int i = 0; i < num_blocks; i++) {
+        for (int p = 0; p < METRICS_POOLS; p++) {
+            const pool_stats_t* stats = &blocks[i].pools[p];
+            if (!stats->name) {
+                continue;
+            }
+            const uint64_t* value = (const uint64_t*)((const char*)stats + offset);
+            arena_printf(out, "%s{worker=\"%d\",pool=\"%s\",size=\"%llu\"} %llu\n", name, i,
+                         stats->name, (unsigned long long)stats->object_size,
+                         (unsigned long long)load(value));
+        }
+    }
+}
+
+char* metrics_render(arena_t* arena, size_t* len) {
+    arena_str_t text = { .arena = arena };
+    arena_str_t* out = &text;
+
+    render_counter(out, "http_requests_total", "Requests answered.",
+                   offsetof(worker_metrics_t, requests));
+    render_counter(out, "http_received_bytes_total", "Bytes read from clients.",
+                   offsetof(worker_metrics_t, bytes_in));
+    render_counter(out, "http_sent_bytes_total", "Bytes written to clients.",
+                   offsetof(worker_metrics_t, bytes_out));
+    render_counter(out, "http_parse_errors_total",
+                   "Requests refused as malformed or too large.",
+                   offsetof(worker_metrics_t, parse_errors));
+    render_counter(out, "http_io_errors_total", "Failed socket reads and writes.",
+                   offsetof(worker_metrics_t, io_errors));
+    render_counter(out, "http_timeouts_total", "Connections closed for idling or stalling.",
+                   offsetof(worker_metrics_t, timeouts));
+    render_counter(out, "http_hot_cache_hits_total", "Static responses served from the hot cache.",
+                   offsetof(worker_metrics_t, hot_hits));
+    render_counter(out, "http_hot_cache_misses_total",
+                   "Small static files read into the hot cache.",
+                   offsetof(worker_metrics_t, hot_misses));
+    render_counter(out, "http_compress_cache_hits_total",
+                   "Responses sent with a body compressed earlier.",
+                   offsetof(worker_metrics_t, compress_hits));
+    render_counter(out, "http_compress_cache_misses_total", "Bodies compressed on the fly.",
+                   offsetof(worker_metrics_t, compress_misses));
+    render_counter(out, "http_uploads_total", "Uploads stored in the upload directory.",
+                   offsetof(worker_metrics_t, uploads));
+    render_counter(out, "http_upload_bytes_spliced_total",
+                   "Upload bytes moved from socket to file without a copy to userspace.",
+                   offsetof(worker_metrics_t, bytes_spliced));
+    render_counter(out, "http_accepted_connections_total", "Connections handed to the worker.",
+                   offsetof(worker_metrics_t, accepts));
+
+    arena_printf(out, "# HELP http_active_connections Connections currently open.\n"
+                 "# TYPE http_active_connections gauge\n");
+    for (int i = 0; i < num_blocks; i++) {
+        arena_printf(out, "http_active_connections{worker=\"%d\"} %llu\n", i,
+                     (unsigned long long)load(&blocks[i].active_connections));
+    }
+
+    // process-wide: summed over every thread's log ring
+    arena_printf(out, "# HELP log_dropped_total Log messages dropped because a log ring was full.\n"
+                 "# TYPE log_dropped_total counter\n"
+                 "log_dropped_total %llu\n", (unsigned long long)log_dropped_total());
+
+    render_pools(out, "http_pool_hits_total", "counter", "Allocations served from a free list.",
+                 offsetof(pool_stats_t, hits));
+    render_pools(out, "http_pool_misses_total", "counter", "Allocations that had to go to malloc.",
+                 offsetof(pool_stats_t, misses));
+    render_pools(out, "http_pool_in_use", "gauge", "Objects currently handed out.",
+                 offsetof(pool_stats_t, in_use));
+    render_pools(out, "http_pool_high_water", "gauge", "Most objects handed out at once.",
+                 offsetof(pool_stats_t, high_water));
+
+    // read from first request byte to response queued
+    arena_printf(out, "# HELP http_request_duration_seconds Time from the first byte of a request "
+                 "to its response being queued.\n"
+                 "# TYPE http_request_duration_seconds histogram\n");
+    for (int i = 0; i < num_blocks; i++) {
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRICS_LATENCY_BUCKETS; b++) {
+            cumulative += load(&blocks[i].latency[b]);
+            if (b == METRICS_LATENCY_BUCKETS - 1) {
+                arena_printf(out,
+                             "http_request_duration_seconds_bucket{worker=\"%d\",le=\"+Inf\"} %llu\n",
+                             i, (unsigned long long)cumulative);
+            } else {
+                arena_printf(out,
+                             "http_request_duration_seconds_bucket{worker=\"%d\",le=\"%g\"} %llu\n",
+                             i, (double)(1ULL << b) / 1e6, (unsigned long long)cumulative);
+            }
+        }
+        arena_printf(out, "http_request_duration_seconds_sum{worker=\"%d\"} %.9f\n", i,
+                     load(&blocks[i].latency_sum_ns) / 1e9);
+        arena_printf(out, "http_request_duration_seconds_count{worker=\"%d\"} %llu\n", i,
+                     (unsigned long long)cumulative);
+    }
+
+    if (text.failed) {
+        return NULL;
+    }
+    *len = text.len;
+    return text.data;
+}
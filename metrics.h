@@ -0,0 +1,79 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "pool.h"
+
+#define METRICS_CACHE_LINE 64
+
+// request latency buckets: bucket i counts requests under 2^i microseconds,
+// the last one everything from 2^22us (about 4.2s) up
+#define METRICS_LATENCY_BUCKETS 24
+
+// the connection slab, each buffer class, and oversized buffers
+#define METRICS_POOLS (BUF_CLASSES + 2)
+
+// one block per worker, written only by the owning worker with plain
+// loads and stores; the scrape reads it with relaxed loads and may catch a
+// request half recorded, which is fine for monitoring. The connection
+// counts are also read by the acceptor on every dispatch, so they start a
+// cache line of their own, away from the per-request counters.
+typedef struct {
+    _Alignas(METRICS_CACHE_LINE) uint64_t requests;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t parse_errors;          // requests refused as malformed or too large
+    uint64_t io_errors;             // failed reads and writes
+    uint64_t timeouts;              // connections closed by a timeout
+    uint64_t hot_hits;              // file responses served from the hot cache
+    uint64_t hot_misses;            // small files that had to be read into it
+    uint64_t compress_hits;         // compressed bodies reused from the worker's cache
+    uint64_t compress_misses;       // bodies compressed on the fly
+    uint64_t uploads;               // request bodies stored under --upload-dir
+    uint64_t bytes_spliced;         // of those, moved socket to file by splice()
+    uint64_t latency_sum_ns;
+    uint64_t latency[METRICS_LATENCY_BUCKETS];
+    pool_stats_t pools[METRICS_POOLS];
+
+    _Alignas(METRICS_CACHE_LINE) uint64_t accepts;
+    uint64_t active_connections;
+} worker_metrics_t;
+
+// allocate zeroed blocks for num_workers workers; returns 0 or -1
+int metrics_init(int num_workers);
+void metrics_free(void);
+worker_metrics_t* metrics_worker(int worker_id);
+
+// single-writer counter update: no lock prefix, but never torn for readers
+static inline void metrics_add(uint64_t* counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_record_latency(worker_metrics_t* m, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= METRICS_LATENCY_BUCKETS) {
+        bucket = METRICS_LATENCY_BUCKETS - 1;
+    }
+    metrics_add(&m->latency[bucket], 1);
+    metrics_add(&m->latency_sum_ns, ns);
+    metrics_add(&m->requests, 1);
+}
+
+static inline void metrics_connection_opened(worker_metrics_t* m) {
+    metrics_add(&m->accepts, 1);
+    metrics_add(&m->active_connections, 1);
+}
+
+static inline void metrics_connection_closed(worker_metrics_t* m) {
+    metrics_add(&m->active_connections, -1);  // wraps back down
+}
+
+// snapshot every worker into Prometheus text exposition format, allocated
+// from arena; NULL on allocation failure
+char* metrics_render(arena_t* arena, size_t* len);
+
+#endif
@@ -0,0 +1,199 @@
+#include "pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void stats_store(uint64_t* field, uint64_t value) {
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+static void stats_alloc(pool_stats_t* stats, bool hit) {
+    if (hit) {
+        stats_store(&stats->hits, stats->hits + 1);
+    } else {
+        stats_store(&stats->misses, stats->misses + 1);
+    }
+    stats_store(&stats->in_use, stats->in_use + 1);
+    if (stats->in_use > stats->high_water) {
+        stats_store(&stats->high_water, stats->in_use);
+    }
+}
+
+static void stats_release(pool_stats_t* stats) {
+    stats_store(&stats->in_use, stats->in_use - 1);
+}
+
+static void push_free(pool_t* pool, void* obj) {
+    *(void**)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->free_count++;
+}
+
+// carve a new chunk into the free list
+static int grow_slab(pool_t* pool) {
+    if (pool->num_slabs == pool->slabs_cap) {
+        size_t cap = pool->slabs_cap ? pool->slabs_cap * 2 : 8;
+        void** slabs = realloc(pool->slabs, cap * sizeof(void*));
+        if (!slabs) {
+            return -1;
+        }
+        pool->slabs = slabs;
+        pool->slabs_cap = cap;
+    }
+
+    char* chunk = aligned_alloc(POOL_CACHE_LINE, pool->obj_size * pool->slab_objects);
+    if (!chunk) {
+        return -1;
+    }
+    pool->slabs[pool->num_slabs++] = chunk;
+    // pushed in reverse so the chunk is handed out front to back
+    for (size_t i = pool->slab_objects; i-- > 0;) {
+        push_free(pool, chunk + i * pool->obj_size);
+    }
+    return 0;
+}
+
+int pool_init(pool_t* pool, size_t obj_size, size_t slab_objects, size_t max_free,
+              size_t prealloc, pool_stats_t* stats) {
+    memset(pool, 0, sizeof(*pool));
+    // room for the free list link, and objects never share a cache line
+    if (obj_size < sizeof(void*)) {
+        obj_size = sizeof(void*);
+    }
+    pool->obj_size = (obj_size + POOL_CACHE_LINE - 1) & ~(size_t)(POOL_CACHE_LINE - 1);
+    pool->slab_objects = slab_objects;
+    pool->max_free = max_free;
+    pool->stats = stats;
+    stats->object_size = obj_size;
+
+    if (slab_objects) {
+        while (pool->free_count < prealloc) {
+            if (grow_slab(pool) == -1) {
+                return -1;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < prealloc && i < max_free; i++) {
+            void* obj = aligned_alloc(POOL_CACHE_LINE, pool->obj_size);
+            if (!obj) {
+                return -1;
+            }
+            push_free(pool, obj);
+        }
+    }
+    return 0;
+}
+
+void pool_destroy(pool_t* pool) {
+    if (pool->slab_objects) {
+        for (size_t i = 0; i < pool->num_slabs; i++) {
+            free(pool->slabs[i]);
+        }
+    } else {
+        while (pool->free_list) {
+            void* obj = pool->free_list;
+            pool->free_list = *(void**)obj;
+            free(obj);
+        }
+    }
+    free(pool->slabs);
+    memset(pool, 0, sizeof(*pool));
+}
+
+void* pool_alloc(pool_t* pool) {
+    bool hit = pool->free_list != NULL;
+    if (!hit) {
+        if (pool->slab_objects) {
+            if (grow_slab(pool) == -1) {
+                return NULL;
+            }
+        } else {
+            void* obj = aligned_alloc(POOL_CACHE_LINE, pool->obj_size);
+            if (!obj) {
+                return NULL;
+            }
+            stats_alloc(pool->stats, false);
+            return obj;
+        }
+    }
+
+    void* obj = pool->free_list;
+    pool->free_list = *(void**)obj;
+    pool->free_count--;
+    stats_alloc(pool->stats, hit);
+    return obj;
+}
+
+void pool_free(pool_t* pool, void* obj) {
+    stats_release(pool->stats);
+    if (!pool->slab_objects && pool->free_count >= pool->max_free) {
+        free(obj);
+        return;
+    }
+    push_free(pool, obj);
+}
+
+int buf_pool_init(buf_pool_t* pool, size_t base_size, const size_t max_free[BUF_CLASSES],
+                  pool_stats_t* stats) {
+    for (int i = 0; i < BUF_CLASSES; i++) {
+        if (pool_init(&pool->classes[i], base_size << (2 * i), 0, max_free[i], 0, &stats[i]) == -1) {
+            return -1;
+        }
+    }
+    pool->oversize = &stats[BUF_CLASSES];
+    return 0;
+}
+
+void buf_pool_destroy(buf_pool_t* pool) {
+    for (int i = 0; i < BUF_CLASSES; i++) {
+        pool_destroy(&pool->classes[i]);
+    }
+}
+
+char* buf_alloc(buf_pool_t* pool, size_t size, size_t* cap) {
+    for (int i = 0; i < BUF_CLASSES; i++) {
+        if (size <= pool->classes[i].obj_size) {
+            char* buf = pool_alloc(&pool->classes[i]);
+            if (buf) {
+                *cap = pool->classes[i].obj_size;
+            }
+            return buf;
+        }
+    }
+
+    char* buf = malloc(size);
+    if (buf) {
+        stats_alloc(pool->oversize, false);
+        *cap = size;
+    }
+    return buf;
+}
+
+void buf_free(buf_pool_t* pool, char* buf, size_t cap) {
+    if (!buf) {
+        return;
+    }
+    for (int i = 0; i < BUF_CLASSES; i++) {
+        if (cap == pool->classes[i].obj_size) {
+            pool_free(&pool->classes[i], buf);
+            return;
+        }
+    }
+    stats_release(pool->oversize);
+    free(buf);
+}
+
+char* buf_resize(buf_pool_t* pool, char* buf, size_t keep, size_t* cap, size_t size) {
+    size_t new_cap;
+    char* grown = buf_alloc(pool, size, &new_cap);
+    if (!grown) {
+        return NULL;
+    }
+    if (keep > 0) {
+        memcpy(grown, buf, keep);
+    }
+    buf_free(pool, buf, *cap);
+    *cap = new_cap;
+    return grown;
+}
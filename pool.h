@@ -0,0 +1,64 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_CACHE_LINE 64
+#define BUF_CLASSES 3               // base, 4x base, 16x base
+
+// written by the owning worker only, read by the metrics scrape
+typedef struct {
+    const char* name;
+    uint64_t object_size;           // 0 for variable-size allocations
+    uint64_t hits;                  // served from the free list
+    uint64_t misses;                // had to go to malloc
+    uint64_t in_use;
+    uint64_t high_water;            // most in use at once
+} pool_stats_t;
+
+// fixed-size object pool for a single thread. In slab mode objects are
+// carved out of cache-line-aligned chunks of slab_objects each and go back
+// on the free list when released; chunks are kept until pool_destroy().
+// Otherwise each object is its own allocation and at most max_free of them
+// are kept on the free list, the rest go back to malloc.
+typedef struct {
+    size_t obj_size;
+    size_t slab_objects;            // 0: allocate objects one at a time
+    size_t max_free;
+    void* free_list;
+    size_t free_count;
+    void** slabs;
+    size_t num_slabs;
+    size_t slabs_cap;
+    pool_stats_t* stats;
+} pool_t;
+
+// returns 0 or -1 if the preallocation failed
+int pool_init(pool_t* pool, size_t obj_size, size_t slab_objects, size_t max_free,
+              size_t prealloc, pool_stats_t* stats);
+void pool_destroy(pool_t* pool);
+void* pool_alloc(pool_t* pool);
+void pool_free(pool_t* pool, void* obj);
+
+// I/O buffers in size classes of base_size << (2 * i); anything bigger
+// comes straight from malloc and is counted in stats[BUF_CLASSES]
+typedef struct {
+    pool_t classes[BUF_CLASSES];
+    pool_stats_t* oversize;
+} buf_pool_t;
+
+// stats has BUF_CLASSES + 1 entries; max_free caps each class's free list
+int buf_pool_init(buf_pool_t* pool, size_t base_size, const size_t max_free[BUF_CLASSES],
+                  pool_stats_t* stats);
+void buf_pool_destroy(buf_pool_t* pool);
+
+// a buffer of at least size bytes; *cap receives its real size
+char* buf_alloc(buf_pool_t* pool, size_t size, size_t* cap);
+// cap is what buf_alloc reported; NULL is ignored
+void buf_free(buf_pool_t* pool, char* buf, size_t cap);
+// move the first keep bytes of buf into a buffer of at least size bytes;
+// on failure NULL is returned and buf is left alone
+char* buf_resize(buf_pool_t* pool, char* buf, size_t keep, size_t* cap, size_t size);
+
+#endif
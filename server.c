@@ -1,8 +1,11 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -10,125 +13,2462 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "compress.h"
+#include "conditional.h"
+#include "file_cache.h"
+#include "hot_cache.h"
+#include "http_parser.h"
+#include "log.h"
+#include "metrics.h"
+#include "pool.h"
+#include "timer_wheel.h"
+#include "uring.h"
+
 #define PORT 8080
 #define MAX_EVENTS 64
 #define MAX_WORKERS 32
-#define BUFFER_SIZE 4096
-#define MAX_CONNECTIONS 1000
+#define BUFFER_SIZE 4096            // smallest buffer class, and the io_uring recv buffer size
+#define MAX_CONNECTIONS 1000        // expected peak, split between workers to size their pools
+#define CONN_SLAB_OBJECTS 64        // connection_t objects carved per slab
+#define LISTEN_BACKLOG 1024
+#define HANDOFF_QUEUE_SIZE 1024     // accepted fds in flight to one worker, power of two
+#define OUTPUT_SEGMENTS 32          // queued iovecs per connection, epoll backend
+#define OUTPUT_COPY_MAX 512         // response pieces shorter than this are copied, not referenced
+#define RESPONSE_PARTS 12
+#define STREAM_CHUNK 8192           // most a streaming producer queues per call
+#define STREAM_BURST 16             // flushes a stream gets before other connections have a turn
+#define STREAM_LINES 1000           // default /stream?lines=
+#define FILE_CACHE_ENTRIES 256      // open files kept per worker with --root
+#define HOT_CACHE_SIZE (32 * 1024 * 1024)   // default --hot-cache, shared by all workers
+#define HOT_OBJECT_MAX (64 * 1024)  // default --hot-object-max
+#define COMPRESS_CACHE_SIZE (8 * 1024 * 1024)   // default --compress-cache, per worker
+#define COMPRESS_MIN_SIZE 1024      // default --compress-min
+#define COMPRESS_BODY_MAX (1024 * 1024)     // larger bodies are sent as they are
+#define MAX_HEADER_SIZE (64 * 1024)
+#define MAX_OUTPUT_BUFFER (256 * 1024)  // queued response bytes before reads pause
+#define KEEPALIVE_TIMEOUT_MS 5000    // idle between requests
+#define HEADER_TIMEOUT_MS 10000      // first byte to end of a request head, never extended
+#define BODY_TIMEOUT_MS 30000        // body read without progress
+#define MAX_BODY_SIZE (1024 * 1024) // default --max-body
+#define SPLICE_PIPE_SIZE (1024 * 1024)  // asked for the upload pipe; the kernel may give less
+#define WRITE_TIMEOUT_MS 30000       // blocked on a client that doesn't read
+#define URING_ENTRIES 4096
+#define URING_RECV_BUFFERS 1024  // provided recv buffers per worker, BUFFER_SIZE each
+#define URING_BGID 0
+
+typedef enum {
+    BACKEND_EPOLL,
+    BACKEND_URING,
+} backend_t;
+
+// how the main thread's accept loop picks a worker
+typedef enum {
+    DISPATCH_ROUND_ROBIN,
+    DISPATCH_LEAST_CONN,    // fewest active connections
+    DISPATCH_P2C,           // less loaded of two random workers
+} dispatch_t;
+
+// accepted fds on their way from the main thread to a worker. Single
+// producer, single consumer; the worker allocates the connection itself so
+// its pools are never touched by another thread.
+typedef struct {
+    _Alignas(POOL_CACHE_LINE) uint32_t head;   // worker
+    _Alignas(POOL_CACHE_LINE) uint32_t tail;   // main thread
+    int fds[HANDOFF_QUEUE_SIZE];
+} handoff_queue_t;
+
+typedef struct {
+    int epoll_fd;
+    int listen_fd;  // -1 unless running in reuseport mode
+    int worker_id;
+    pthread_t thread;
+    uring_t ring;                   // io_uring backend only
+    uring_buf_ring_t recv_bufs;
+    worker_metrics_t* metrics;
+    timer_wheel_t timers;           // connection timeouts
+    char hello[32];                 // the default response body, formatted once
+    size_t hello_len;
+    char date[48];                  // "Date: ...\r\n" for date_sec
+    size_t date_len;
+    time_t date_sec;
+    pool_t conn_pool;               // connection_t slabs
+    buf_pool_t buf_pool;            // in/out buffers
+    handoff_queue_t* handoff;       // single acceptor mode only
+    int handoff_fd;                 // eventfd raised when handoff gets fds
+    file_cache_t files;             // --root only
+    compressor_t compress;          // unless --compress-cache is 0
+    struct connection* stream_ready;    // epoll: streams that yielded with room to write
+    int splice_pipe[2];             // --upload-dir: socket to file, empty between uses
+    size_t splice_pipe_size;
+    uint64_t uploads;               // names the next upload's temporary file
+} worker_t;
+
+// what the server needs to know about a request once its head is parsed
+typedef struct {
+    int minor_version;      // HTTP/1.x
+    bool keep_alive;
+    bool chunked;           // Transfer-Encoding: chunked, else content_length frames the body
+    bool expect_continue;   // the client waits for 100 Continue before sending the body
+    uint64_t content_length;
+} request_info_t;
+
+typedef enum {
+    CONN_READ_HEADERS,      // waiting for a complete request head
+    CONN_READ_BODY,         // consuming the body of the current request
+} conn_state_t;
+
+// which deadline a connection's timer is running for
+typedef enum {
+    TIMEOUT_NONE,
+    TIMEOUT_KEEPALIVE,
+    TIMEOUT_HEADER,
+    TIMEOUT_BODY,
+    TIMEOUT_WRITE,
+} timeout_kind_t;
+
+// one piece of queued output: len bytes at ref, len bytes of file from
+// off, or out_buf bytes from off when neither is set
+typedef struct {
+    const char* ref;
+    file_entry_t* file;     // a reference is held until the piece is sent
+    hot_object_t* hot;      // the object ref points into, likewise held
+    compressed_t* compressed;   // likewise
+    size_t off;
+    size_t len;
+} out_seg_t;
+
+struct connection;
+
+// a response whose length isn't known up front. Its body goes out in
+// chunks, or to an HTTP/1.0 client until the connection closes, and
+// produce() is asked for more only while the output queue has room, so a
+// fast producer waits for a slow client instead of filling memory.
+typedef struct {
+    // queue the next part of the body with stream_write(); false once it
+    // is complete. NULL while no response is streaming.
+    bool (*produce)(struct connection* conn);
+    bool chunked;
+    uint64_t next;          // the producer's position
+    uint64_t end;
+} response_stream_t;
+
+// the body of the request being read. A handler that wants it sets
+// on_data, called with each run of body bytes as they arrive, and on_end,
+// which answers once the body is complete; otherwise the response went out
+// with the head and the body is skipped.
+typedef struct {
+    http_body_t framing;
+    request_info_t info;    // of the request the body belongs to
+    uint64_t received;
+    // false if the handler gives up, having queued its response; the rest
+    // of the body is not read and the connection closes
+    bool (*on_data)(struct connection* conn, http_slice_t data);
+    void (*on_end)(struct connection* conn);
+    // the body won't be finished: release what on_data was filling
+    void (*on_abort)(struct connection* conn);
+    int splice_fd;          // -1, or a file the rest of a Content-Length body is spliced to
+    uint64_t state;         // the handler's running state
+    void* ctx;
+} request_body_t;
+
+// per-connection state, registered in epoll through data.ptr
+typedef struct connection {
+    int fd;
+    worker_t* worker;
+    conn_state_t state;
+    char* in_buf;           // growable input buffer, pending request at offset 0
+    size_t in_len;
+    size_t in_cap;
+    http_parser_t parser;   // resumes the pending request head
+    arena_t arena;          // scratch memory for the request being answered
+    request_body_t body;    // CONN_READ_BODY only
+    uint64_t request_start; // when the current request's first byte was read
+    uint64_t last_read;
+    char* out_buf;          // queued response bytes, unsent ones from out_off
+    size_t out_off;
+    size_t out_len;
+    size_t out_cap;
+    // epoll backend: the output queue in writev order. Small pieces are
+    // copied to out_buf; larger ones are referenced where they lie, in
+    // static data or the arena, until written.
+    out_seg_t segs[OUTPUT_SEGMENTS];
+    int seg_head;
+    int seg_count;
+    size_t ref_pending;     // unsent bytes referenced outside out_buf
+    bool want_write;        // EPOLLOUT currently registered
+    bool read_paused;       // stopped reading because the output queue is full
+    bool closing;           // close once the output queue drains
+    response_stream_t stream;   // later requests wait until it is complete
+    struct connection* ready_next;  // on the worker's stream_ready list
+    bool ready;
+
+    wheel_timer_t timer;    // on the worker's wheel
+    timeout_kind_t timeout_kind;
+    bool progress;          // bytes moved since the timer was last looked at
+
+    // io_uring backend: the kernel reads send_buf while a send is in flight,
+    // so new output keeps going to out_buf and the two swap between sends
+    char* send_buf;
+    size_t send_off;
+    size_t send_len;
+    size_t send_cap;
+    int ops_inflight;       // SQEs whose final completion hasn't arrived
+    bool send_inflight;
+    bool recv_armed;        // multishot recv active
+    bool recv_cancelled;
+    bool dead;              // free once ops_inflight drops to zero
+} connection_t;
+
+static worker_t* workers;
+static int num_workers = 0;
+static int server_fd = -1;
+static bool use_reuseport = false;
+static backend_t backend = BACKEND_EPOLL;
+static dispatch_t dispatch = DISPATCH_ROUND_ROBIN;
+static const char* doc_root = NULL;
+static size_t hot_cache_size = HOT_CACHE_SIZE;
+static size_t hot_object_max = HOT_OBJECT_MAX;
+static hot_cache_t hot_cache;       // --root with a non-zero --hot-cache only
+static bool hot_enabled = false;
+static size_t compress_cache_size = COMPRESS_CACHE_SIZE;
+static size_t compress_min = COMPRESS_MIN_SIZE;
+static size_t compress_max = 0;     // largest body compressed on the fly, 0 when off
+static size_t max_body = MAX_BODY_SIZE;
+static const char* upload_dir = NULL;
+static int upload_dir_fd = -1;
+#ifdef DEBUG
+static int initial_log_level = LOG_LEVEL_DEBUG;
+#else
+static int initial_log_level = LOG_LEVEL_INFO;
+#endif
+static volatile bool running = true;
+
+// main waits here until every worker has set up, so none is dispatched to
+// or counted as a hot cache reader without being able to serve
+static pthread_barrier_t workers_ready;
+static bool worker_failed;
+
+static void* worker_thread(void* arg);
+static int create_listen_socket(bool reuseport);
+static void handle_connection(connection_t* conn, uint32_t events);
+static void uring_worker_loop(worker_t* worker);
+static void connection_timed_out(wheel_timer_t* timer);
+static void connection_update_timer(connection_t* conn);
+static void signal_handler(int signum);
+
+static void signal_handler(int signum) {
+    printf("\nReceived signal %d, shutting down...\n", signum);
+    running = false;
+    if (server_fd != -1) {
+        close(server_fd);  // This will break the accept loop
+    }
+}
+
+static int make_socket_non_blocking(int sfd) {
+    int flags = fcntl(sfd, F_GETFL, 0);
+    if (flags == -1) {
+        log_errno("fcntl F_GETFL");
+        return -1;
+    }
+    if (fcntl(sfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        log_errno("fcntl F_SETFL O_NONBLOCK");
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// let the handler reading a body clean up after it, once
+static void body_abandon(connection_t* conn) {
+    if (conn->body.on_abort) {
+        conn->body.on_abort(conn);
+        conn->body.on_abort = NULL;
+    }
+}
+
+// connections and their buffers come from the worker's pools, so this and
+// connection_close() only ever run on the owning worker
+static connection_t* connection_create(worker_t* worker, int fd) {
+    connection_t* conn = pool_alloc(&worker->conn_pool);
+    if (!conn) {
+        return NULL;
+    }
+    memset(conn, 0, sizeof(*conn));
+    conn->in_buf = buf_alloc(&worker->buf_pool, BUFFER_SIZE, &conn->in_cap);
+    if (!conn->in_buf) {
+        pool_free(&worker->conn_pool, conn);
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->worker = worker;
+    conn->state = CONN_READ_HEADERS;
+    // output is queued whole and flushed in as few calls as possible; Nagle
+    // would only stall the second of two, e.g. a sendfile() after headers
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    arena_init(&conn->arena, &worker->buf_pool);
+    http_parser_init(&conn->parser, MAX_HEADER_SIZE, HTTP_MAX_HEADERS);
+    metrics_connection_opened(worker->metrics);
+    return conn;
+}
+
+// closing the fd also drops it from the worker's epoll set
+static void connection_close(connection_t* conn) {
+    worker_t* worker = conn->worker;
+    for (int i = 0; i < conn->seg_count; i++) {
+        if (conn->segs[conn->seg_head + i].file) {
+            file_cache_release(conn->segs[conn->seg_head + i].file);
+        }
+        if (conn->segs[conn->seg_head + i].hot) {
+            hot_object_release(conn->segs[conn->seg_head + i].hot);
+        }
+        if (conn->segs[conn->seg_head + i].compressed) {
+            compressed_release(conn->segs[conn->seg_head + i].compressed);
+        }
+    }
+    body_abandon(conn);
+    if (conn->ready) {
+        struct connection** link = &worker->stream_ready;
+        while (*link != conn) {
+            link = &(*link)->ready_next;
+        }
+        *link = conn->ready_next;
+    }
+    metrics_connection_closed(worker->metrics);
+    timer_cancel(&worker->timers, &conn->timer);
+    close(conn->fd);
+    arena_reset(&conn->arena);
+    buf_free(&worker->buf_pool, conn->in_buf, conn->in_cap);
+    buf_free(&worker->buf_pool, conn->out_buf, conn->out_cap);
+    buf_free(&worker->buf_pool, conn->send_buf, conn->send_cap);
+    pool_free(&worker->conn_pool, conn);
+}
+
+// add a freshly accepted, non-blocking client socket to this worker's epoll set
+static int register_client(worker_t* worker, int client_fd) {
+    connection_t* conn = connection_create(worker, client_fd);
+    if (!conn) {
+        log_errno("connection_create");
+        close(client_fd);
+        return -1;
+    }
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLET,
+        .data.ptr = conn
+    };
+
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
+        log_errno("epoll_ctl");
+        connection_close(conn);
+        return -1;
+    }
+    // the idle timeout runs even if the client never sends a byte
+    connection_update_timer(conn);
+    return 0;
+}
+
+// mark the handoff eventfd and the file cache's inotify fd in the worker's epoll set
+static char handoff_tag;
+static char inotify_tag;
+
+// main thread side; false if the worker is too far behind to take the fd
+static bool handoff_push(worker_t* worker, int client_fd) {
+    handoff_queue_t* q = worker->handoff;
+    uint32_t tail = q->tail;
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == HANDOFF_QUEUE_SIZE) {
+        return false;
+    }
+    q->fds[tail & (HANDOFF_QUEUE_SIZE - 1)] = client_fd;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    uint64_t one = 1;
+    if (write(worker->handoff_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        log_errno("write handoff eventfd");
+    }
+    return true;
+}
+
+// worker side: take every fd the main thread has queued
+static void drain_handoff(worker_t* worker) {
+    handoff_queue_t* q = worker->handoff;
+    uint64_t count;
+    if (read(worker->handoff_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        log_errno("read handoff eventfd");
+    }
+
+    uint32_t head = q->head;
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        register_client(worker, q->fds[head & (HANDOFF_QUEUE_SIZE - 1)]);
+    }
+    __atomic_store_n(&q->head, head, __ATOMIC_RELEASE);
+}
+
+// reuseport mode: drain this worker's own listening socket, so accepted
+// connections stay on the thread that accepted them
+static void accept_connections(worker_t* worker) {
+    while (running) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+
+        int client_fd = accept4(worker->listen_fd, (struct sockaddr*)&client_addr,
+                                &client_len, SOCK_NONBLOCK);
+        if (client_fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_errno("accept4");
+            }
+            return;
+        }
+
+        if (register_client(worker, client_fd) == -1) {
+            continue;
+        }
+
+        log_debug("New connection from %s:%d accepted by worker %d",
+               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), worker->worker_id);
+    }
+}
+
+static void epoll_worker_loop(worker_t* worker) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running) {
+        if (hot_enabled) {
+            // hot objects looked up in the last round are no longer referenced
+            // except through holds, so the cache may free what it retired
+            hot_cache_quiescent(&hot_cache, worker->worker_id);
+        }
+        // sleep until the next connection deadline, or a second to notice
+        // shutdown; not at all while streams are waiting for their turn
+        int timeout = worker->stream_ready
+            ? 0 : timer_wheel_timeout(&worker->timers, monotonic_ms(), 1000);
+        int n = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, timeout);
+        
+        if (n == -1) {
+            if (errno == EINTR) continue;  // Interrupted system call
+            log_errno("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            connection_t* conn = events[i].data.ptr;
+            if (!conn) {
+                accept_connections(worker);
+                continue;
+            }
+            if (events[i].data.ptr == &handoff_tag) {
+                drain_handoff(worker);
+                continue;
+            }
+            if (events[i].data.ptr == &inotify_tag) {
+                file_cache_process_events(&worker->files);
+                continue;
+            }
+            handle_connection(conn, events[i].events);
+        }
+
+        // streams whose sockets took all they were given last time round
+        connection_t* ready = worker->stream_ready;
+        worker->stream_ready = NULL;
+        while (ready) {
+            connection_t* conn = ready;
+            ready = conn->ready_next;
+            conn->ready = false;
+            handle_connection(conn, 0);
+        }
+        timer_wheel_advance(&worker->timers, monotonic_ms(), connection_timed_out);
+    }
+}
+
+static void* worker_thread(void* arg) {
+    worker_t* worker = (worker_t*)arg;
+
+    char name[16];
+    snprintf(name, sizeof(name), "worker-%d", worker->worker_id);
+    log_thread_init(name);
+    timer_wheel_init(&worker->timers, monotonic_ms());
+    worker->hello_len = snprintf(worker->hello, sizeof(worker->hello), "Hello from worker %d!\n",
+                                 worker->worker_id);
+
+    // preallocate this worker's share of connections; buffer free lists are
+    // capped so a burst doesn't pin its peak memory forever
+    size_t share = MAX_CONNECTIONS / num_workers + 1;
+    size_t max_free[BUF_CLASSES] = { 2 * share, share / 4 + 1, share / 16 + 1 };
+    pool_stats_t* stats = worker->metrics->pools;
+    stats[0].name = "connection";
+    for (int i = 0; i < BUF_CLASSES; i++) {
+        stats[1 + i].name = "buffer";
+    }
+    stats[1 + BUF_CLASSES].name = "buffer-oversize";
+    if (pool_init(&worker->conn_pool, sizeof(connection_t), CONN_SLAB_OBJECTS, 0, share,
+                  &stats[0]) == -1 ||
+        buf_pool_init(&worker->buf_pool, BUFFER_SIZE, max_free, &stats[1]) == -1) {
+        log_error("Worker %d: cannot allocate its pools", worker->worker_id);
+        goto failed;
+    }
+    if (compress_max > 0 &&
+        compressor_init(&worker->compress, compress_cache_size, compress_max) == -1) {
+        log_errno("compressor_init");
+        goto failed;
+    }
+    if (doc_root) {
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.ptr = &inotify_tag
+        };
+        if (file_cache_init(&worker->files, doc_root, FILE_CACHE_ENTRIES, compress_min,
+                            compress_max) == -1 ||
+            epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->files.inotify_fd, &event) == -1) {
+            log_errno("file cache");
+            goto failed;
+        }
+    }
+    if (upload_dir) {
+        if (pipe2(worker->splice_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+            log_errno("pipe2");
+            goto failed;
+        }
+        fcntl(worker->splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+        worker->splice_pipe_size = fcntl(worker->splice_pipe[1], F_GETPIPE_SZ);
+    }
+    log_info("Worker %d started", worker->worker_id);
+    pthread_barrier_wait(&workers_ready);
+
+    if (backend == BACKEND_URING) {
+        uring_worker_loop(worker);
+    } else {
+        epoll_worker_loop(worker);
+    }
+
+    // connections still open at shutdown are abandoned along with their memory
+    if (hot_enabled) {
+        hot_cache_offline(&hot_cache, worker->worker_id);
+    }
+    if (doc_root) {
+        file_cache_destroy(&worker->files);
+    }
+    if (compress_max > 0) {
+        compressor_destroy(&worker->compress);
+    }
+    if (upload_dir) {
+        close(worker->splice_pipe[0]);
+        close(worker->splice_pipe[1]);
+    }
+    buf_pool_destroy(&worker->buf_pool);
+    pool_destroy(&worker->conn_pool);
+    return NULL;
+
+failed:
+    // main exits once every worker is at the barrier
+    if (hot_enabled) {
+        hot_cache_offline(&hot_cache, worker->worker_id);
+    }
+    __atomic_store_n(&worker_failed, true, __ATOMIC_RELAXED);
+    pthread_barrier_wait(&workers_ready);
+    return NULL;
+}
+
+// 1*DIGIT, short enough not to overflow
+static bool parse_content_length(http_slice_t value, uint64_t* length) {
+    if (value.len == 0 || value.len > 18) {
+        return false;
+    }
+    *length = 0;
+    for (size_t i = 0; i < value.len; i++) {
+        char c = value.ptr[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        *length = *length * 10 + (c - '0');
+    }
+    return true;
+}
+
+static bool is_token_char(char c) {
+    return c > ' ' && c < 0x7f && !strchr("\"(),/:;<=>?@[\\]{}", c);
+}
+
+// add the codings of one Transfer-Encoding line to those of the lines
+// before it: *count of them in all, *chunked while the last is a bare
+// "chunked". False if the value isn't a comma separated list of codings.
+static bool add_codings(http_slice_t value, int* count, bool* chunked) {
+    const char* p = value.ptr;
+    const char* end = value.ptr + value.len;
+    while (p < end) {
+        const char* next = memchr(p, ',', end - p);
+        if (!next) {
+            next = end;
+        }
+        while (p < next && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        const char* stop = next;
+        while (stop > p && (stop[-1] == ' ' || stop[-1] == '\t')) {
+            stop--;
+        }
+        // empty elements are allowed in a list and mean nothing
+        if (p < stop) {
+            const char* token = p;
+            while (p < stop && is_token_char(*p)) {
+                p++;
+            }
+            const char* params = p;
+            while (params < stop && (*params == ' ' || *params == '\t')) {
+                params++;
+            }
+            if (p == token || (params < stop && *params != ';')) {
+                return false;
+            }
+            (*count)++;
+            http_slice_t coding = { token, p - token };
+            *chunked = p == stop && http_slice_case_eq(coding, "chunked");
+        }
+        p = next < end ? next + 1 : end;
+    }
+    return true;
+}
+
+// pull the framing details out of a parsed head; NULL, or the error status
+// the request gets instead of an answer if they are invalid
+static const char* interpret_request(const http_request_t* req, request_info_t* info) {
+    info->minor_version = req->minor_version;
+    info->keep_alive = req->minor_version == 1;  // HTTP/1.1 defaults to persistent
+    info->chunked = false;
+    info->expect_continue = false;
+    info->content_length = 0;
+
+    const http_slice_t* connection = http_find_header(req, "Connection");
+    if (connection) {
+        if (http_header_has_token(*connection, "close")) {
+            info->keep_alive = false;
+        } else if (http_header_has_token(*connection, "keep-alive")) {
+            info->keep_alive = true;
+        }
+    }
+
+    // every Content-Length and Transfer-Encoding line counts: a request
+    // framed one way by its first header and another by a later one is how
+    // request smuggling looks, so it is refused rather than guessed
+    bool has_length = false;
+    bool has_coding = false;
+    bool codings_valid = true;
+    int codings = 0;
+    bool chunked = false;
+    for (size_t i = 0; i < req->num_headers; i++) {
+        const http_header_t* header = &req->headers[i];
+        if (http_slice_case_eq(header->name, "Content-Length")) {
+            uint64_t length;
+            if (!parse_content_length(header->value, &length) ||
+                (has_length && length != info->content_length)) {
+                return "400 Bad Request";
+            }
+            has_length = true;
+            info->content_length = length;
+        } else if (http_slice_case_eq(header->name, "Transfer-Encoding")) {
+            has_coding = true;
+            codings_valid &= add_codings(header->value, &codings, &chunked);
+        }
+    }
+
+    // chunked is the only coding taken, and only on its own. Together with
+    // Content-Length, or from an HTTP/1.0 client, the framing is ambiguous.
+    if (has_coding) {
+        if (has_length || req->minor_version == 0 || !codings_valid || codings == 0) {
+            return "400 Bad Request";
+        }
+        if (codings != 1 || !chunked) {
+            return "501 Not Implemented";
+        }
+        info->chunked = true;
+    }
+
+    // HTTP/1.0 has no 100 Continue, so the header means nothing there
+    const http_slice_t* expect = http_find_header(req, "Expect");
+    if (expect && req->minor_version == 1) {
+        if (!http_slice_case_eq(*expect, "100-continue")) {
+            return "417 Expectation Failed";
+        }
+        info->expect_continue = true;
+    }
+    return NULL;
+}
+
+static const char* parse_error_status(http_parse_result_t rc) {
+    switch (rc) {
+    case HTTP_PARSE_HEAD_TOO_LARGE:
+    case HTTP_PARSE_TOO_MANY_HEADERS:
+        return "431 Request Header Fields Too Large";
+    case HTTP_PARSE_BAD_VERSION:
+        return "505 HTTP Version Not Supported";
+    default:
+        return "400 Bad Request";
+    }
+}
+
+// queued plus in flight (io_uring), the figure backpressure is based on
+static size_t output_pending(const connection_t* conn) {
+    return (conn->out_len - conn->out_off) + conn->ref_pending + (conn->send_len - conn->send_off);
+}
+
+// stop taking requests: too many bytes queued, or too few segments left
+// for a response that references a file or buffer
+static bool output_full(const connection_t* conn) {
+    return output_pending(conn) >= MAX_OUTPUT_BUFFER || conn->seg_count > OUTPUT_SEGMENTS - 3;
+}
+
+// no more requests are answered while the output queue is full or a
+// response is still streaming; reading pauses until then
+static bool input_blocked(const connection_t* conn) {
+    return output_full(conn) || conn->stream.produce;
+}
+
+// append a segment, merging out_buf bytes into the previous one when they follow it
+static void output_add_seg(connection_t* conn, const char* ref, file_entry_t* file, size_t off,
+                           size_t len) {
+    if (conn->seg_count > 0) {
+        out_seg_t* last = &conn->segs[conn->seg_head + conn->seg_count - 1];
+        if (!ref && !file && !last->ref && !last->file && last->off + last->len == off) {
+            last->len += len;
+            return;
+        }
+    }
+    if (conn->seg_head + conn->seg_count == OUTPUT_SEGMENTS) {
+        memmove(conn->segs, conn->segs + conn->seg_head, conn->seg_count * sizeof(out_seg_t));
+        conn->seg_head = 0;
+    }
+    out_seg_t* seg = &conn->segs[conn->seg_head + conn->seg_count++];
+    *seg = (out_seg_t){ .ref = ref, .file = file, .off = off, .len = len };
+}
+
+// queue a copy of response bytes; they go out on the next connection_flush()
+static bool output_append(connection_t* conn, const char* data, size_t len) {
+    if (conn->out_off > 0 && conn->out_len + len > conn->out_cap) {
+        memmove(conn->out_buf, conn->out_buf + conn->out_off, conn->out_len - conn->out_off);
+        for (int i = 0; i < conn->seg_count; i++) {
+            out_seg_t* seg = &conn->segs[conn->seg_head + i];
+            if (!seg->ref && !seg->file) {
+                seg->off -= conn->out_off;
+            }
+        }
+        conn->out_len -= conn->out_off;
+        conn->out_off = 0;
+    }
+    if (conn->out_len + len > conn->out_cap) {
+        size_t size = conn->out_cap ? conn->out_cap : BUFFER_SIZE;
+        while (size < conn->out_len + len) size *= 2;
+        char* grown = buf_resize(&conn->worker->buf_pool, conn->out_buf, conn->out_len,
+                                 &conn->out_cap, size);
+        if (!grown) {
+            log_errno("buf_resize");
+            return false;
+        }
+        conn->out_buf = grown;
+    }
+    memcpy(conn->out_buf + conn->out_len, data, len);
+    if (backend == BACKEND_EPOLL) {
+        output_add_seg(conn, NULL, NULL, conn->out_len, len);
+    }
+    conn->out_len += len;
+    return true;
+}
+
+// queue a response without copying its larger pieces, which must stay put
+// until written. A reference needs a spare segment behind it so copies can
+// always follow. io_uring sends run after the handler has returned, from a
+// buffer the connection owns, so everything is copied there.
+static bool output_response(connection_t* conn, const struct iovec* parts, int count) {
+    for (int i = 0; i < count; i++) {
+        size_t len = parts[i].iov_len;
+        if (backend == BACKEND_EPOLL && len >= OUTPUT_COPY_MAX &&
+            conn->seg_count <= OUTPUT_SEGMENTS - 2) {
+            output_add_seg(conn, parts[i].iov_base, NULL, 0, len);
+            conn->ref_pending += len;
+        } else if (!output_append(conn, parts[i].iov_base, len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// queue len bytes of a file from off, sent with sendfile() when their
+// turn comes; epoll backend only, and output_full() guarantees the segment
+static void output_file(connection_t* conn, file_entry_t* file, off_t off, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    output_add_seg(conn, NULL, file, off, len);
+    conn->ref_pending += len;
+    file->refs++;
+}
+
+// queue the body of a cached response. Like output_response(), only a
+// referenced body has to outlive the handler, so only then is the object
+// held; small ones are copied and never touch its reference count.
+static bool output_hot(connection_t* conn, hot_object_t* obj) {
+    const char* body = obj->data + obj->head_len;
+    if (backend == BACKEND_EPOLL && obj->body_len >= OUTPUT_COPY_MAX &&
+        conn->seg_count <= OUTPUT_SEGMENTS - 2) {
+        output_add_seg(conn, body, NULL, 0, obj->body_len);
+        conn->segs[conn->seg_head + conn->seg_count - 1].hot = obj;
+        conn->ref_pending += obj->body_len;
+        hot_object_hold(obj);
+        return true;
+    }
+    return output_append(conn, body, obj->body_len);
+}
+
+// queue a compressed body the same way; the caller keeps its own reference
+static bool output_compressed(connection_t* conn, compressed_t* body) {
+    if (backend == BACKEND_EPOLL && body->len >= OUTPUT_COPY_MAX &&
+        conn->seg_count <= OUTPUT_SEGMENTS - 2) {
+        output_add_seg(conn, body->data, NULL, 0, body->len);
+        conn->segs[conn->seg_head + conn->seg_count - 1].compressed = body;
+        conn->ref_pending += body->len;
+        body->refs++;
+        return true;
+    }
+    return output_append(conn, body->data, body->len);
+}
+
+// drop n written bytes from the front of the segment queue
+static void output_consumed(connection_t* conn, size_t n) {
+    while (n > 0) {
+        out_seg_t* seg = &conn->segs[conn->seg_head];
+        size_t take = n < seg->len ? n : seg->len;
+        if (seg->ref) {
+            seg->ref += take;
+            conn->ref_pending -= take;
+        } else if (seg->file) {
+            seg->off += take;
+            conn->ref_pending -= take;
+        } else {
+            seg->off += take;
+            conn->out_off += take;
+        }
+        seg->len -= take;
+        n -= take;
+        if (seg->len == 0) {
+            if (seg->file) {
+                file_cache_release(seg->file);
+            }
+            if (seg->hot) {
+                hot_object_release(seg->hot);
+            }
+            if (seg->compressed) {
+                compressed_release(seg->compressed);
+            }
+            conn->seg_head++;
+            conn->seg_count--;
+        }
+    }
+}
+
+// everything queued has been written: rewind the buffer and release the
+// scratch memory the responses came from
+static void output_drained(connection_t* conn) {
+    conn->out_off = conn->out_len = 0;
+    conn->seg_head = 0;
+    arena_reset(&conn->arena);
+}
+
+// register EPOLLOUT only while there is something left to write
+static void connection_update_events(connection_t* conn) {
+    bool want_write = output_pending(conn) > 0;
+    if (want_write == conn->want_write) {
+        return;
+    }
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLET | (want_write ? EPOLLOUT : 0),
+        .data.ptr = conn
+    };
+    if (epoll_ctl(conn->worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) == -1) {
+        log_errno("epoll_ctl EPOLL_CTL_MOD");
+        return;
+    }
+    conn->want_write = want_write;
+}
+
+// write queued output until it is gone or the socket is full
+// returns false on a write error
+static bool connection_flush(connection_t* conn) {
+    while (conn->seg_count > 0) {
+        const out_seg_t* head = &conn->segs[conn->seg_head];
+        ssize_t n;
+        if (head->file) {
+            // file data goes from the page cache to the socket, never through userspace
+            off_t off = head->off;
+            n = sendfile(conn->fd, head->file->fd, &off, head->len);
+            if (n == 0) {
+                // the file shrank under us; the promised length can't be met
+                log_warn("Worker %d: %s truncated while being sent", conn->worker->worker_id,
+                         head->file->name);
+                return false;
+            }
+        } else {
+            // everything up to the next file segment in one gathered write
+            struct iovec iov[OUTPUT_SEGMENTS];
+            int count = 0;
+            for (; count < conn->seg_count; count++) {
+                const out_seg_t* seg = &conn->segs[conn->seg_head + count];
+                if (seg->file) {
+                    break;
+                }
+                iov[count].iov_base = (void*)(seg->ref ? seg->ref : conn->out_buf + seg->off);
+                iov[count].iov_len = seg->len;
+            }
+            // headers ahead of a file body wait for it, so the two share packets
+            struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+            n = sendmsg(conn->fd, &msg, count < conn->seg_count ? MSG_MORE : 0);
+        }
+        if (n > 0) {
+            output_consumed(conn, n);
+            conn->progress = true;
+            metrics_add(&conn->worker->metrics->bytes_out, n);
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            metrics_add(&conn->worker->metrics->io_errors, 1);
+            if (errno != EPIPE && errno != ECONNRESET) {
+                log_errno(head->file ? "sendfile" : "sendmsg");
+            }
+            return false;
+        }
+    }
+
+    if (output_pending(conn) == 0) {
+        output_drained(conn);
+    }
+    connection_update_events(conn);
+    return true;
+}
+
+// a response as the pieces it is sent from: precomputed header blocks,
+// per-request header lines and the body, in order
+typedef struct {
+    struct iovec parts[RESPONSE_PARTS];
+    int count;
+    char length[40];        // Content-Length line
+} response_t;
+
+#define STATIC_BLOCK(s) s, sizeof(s) - 1
+
+// header blocks shared by every response of a kind; only the lines that
+// change per request are produced on the request path
+static const char hello_head[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+static const char metrics_head[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n";
+static const char status_tail[] = "Content-Length: 0\r\nConnection: close\r\n\r\n";
+
+static void response_add(response_t* resp, const void* data, size_t len) {
+    if (len > 0 && resp->count < RESPONSE_PARTS) {
+        resp->parts[resp->count].iov_base = (void*)data;
+        resp->parts[resp->count].iov_len = len;
+        resp->count++;
+    }
+}
+
+// the Date header, reformatted only when the second changes; each worker
+// keeps its own copy so reading it takes no synchronisation
+static void response_add_date(response_t* resp, worker_t* worker) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    if (now.tv_sec != worker->date_sec) {
+        struct tm tm;
+        gmtime_r(&now.tv_sec, &tm);
+        worker->date_len = strftime(worker->date, sizeof(worker->date),
+                                    "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        worker->date_sec = now.tv_sec;
+    }
+    response_add(resp, worker->date, worker->date_len);
+}
+
+// the Connection header if the default needs overriding, and the blank
+// line ending the head
+static void response_finish_head(response_t* resp, const request_info_t* req) {
+    if (!req->keep_alive) {
+        response_add(resp, STATIC_BLOCK("Connection: close\r\n"));
+    } else if (req->minor_version == 0) {
+        response_add(resp, STATIC_BLOCK("Connection: keep-alive\r\n"));
+    }
+    response_add(resp, STATIC_BLOCK("\r\n"));
+}
+
+// Content-Length, then response_finish_head()
+static void response_end_head(response_t* resp, const request_info_t* req, size_t body_len) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + body_len % 10;
+        body_len /= 10;
+    } while (body_len > 0);
+
+    char* p = resp->length;
+    memcpy(p, "Content-Length: ", 16);
+    p += 16;
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    *p++ = '\r';
+    *p++ = '\n';
+    response_add(resp, resp->length, p - resp->length);
+    response_finish_head(resp, req);
+}
+
+static void response_send(connection_t* conn, const response_t* resp) {
+    if (!output_response(conn, resp->parts, resp->count)) {
+        conn->closing = true;
+    }
+}
+
+static void respond_status(connection_t* conn, const char* status) {
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK("HTTP/1.1 "));
+    response_add(&resp, status, strlen(status));
+    response_add(&resp, STATIC_BLOCK("\r\n"));
+    response_add_date(&resp, conn->worker);
+    response_add(&resp, STATIC_BLOCK(status_tail));
+    response_send(conn, &resp);
+}
+
+// a response without a body, keeping the connection as the request asked;
+// extra is a header block to include, or NULL
+static void respond_empty(connection_t* conn, const request_info_t* req, const char* status,
+                          const char* extra) {
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK("HTTP/1.1 "));
+    response_add(&resp, status, strlen(status));
+    response_add(&resp, STATIC_BLOCK("\r\n"));
+    response_add_date(&resp, conn->worker);
+    if (extra) {
+        response_add(&resp, extra, strlen(extra));
+    }
+    response_end_head(&resp, req, 0);
+    response_send(conn, &resp);
+}
+
+// queue one chunk of a streaming body. False if it could not be queued,
+// which abandons the stream and the connection.
+static bool stream_write(connection_t* conn, const char* data, size_t len) {
+    if (len == 0) {
+        return true;    // an empty chunk would end the body
+    }
+    bool queued;
+    if (conn->stream.chunked) {
+        char size[20];
+        int n = snprintf(size, sizeof(size), "%zx\r\n", len);
+        queued = output_append(conn, size, n) && output_append(conn, data, len) &&
+                 output_append(conn, STATIC_BLOCK("\r\n"));
+    } else {
+        queued = output_append(conn, data, len);
+    }
+    if (!queued) {
+        conn->stream.produce = NULL;
+        conn->closing = true;
+    }
+    return queued;
+}
+
+// the last chunk, or for HTTP/1.0 the close that ends the body
+static void stream_end(connection_t* conn) {
+    conn->stream.produce = NULL;
+    if (!conn->stream.chunked || !output_append(conn, STATIC_BLOCK("0\r\n\r\n"))) {
+        conn->closing = true;
+    }
+}
+
+// ask the producer for more until the queue is full or the body complete
+static void stream_pump(connection_t* conn) {
+    while (conn->stream.produce && !output_full(conn)) {
+        if (!conn->stream.produce(conn) && conn->stream.produce) {
+            stream_end(conn);
+        }
+    }
+}
+
+// queue the head of a streamed response (head being its status and
+// Content-Type lines) and start producing its body from next to end.
+// HEAD gets the head only.
+static void respond_stream(connection_t* conn, const request_info_t* req, bool head_only,
+                           const char* head, size_t head_len,
+                           bool (*produce)(connection_t* conn), uint64_t next, uint64_t end) {
+    bool chunked = req->minor_version >= 1;
+    response_t resp = { .count = 0 };
+    response_add(&resp, head, head_len);
+    response_add_date(&resp, conn->worker);
+    if (chunked) {
+        response_add(&resp, STATIC_BLOCK("Transfer-Encoding: chunked\r\n"));
+        response_finish_head(&resp, req);
+    } else {
+        response_add(&resp, STATIC_BLOCK("Connection: close\r\n\r\n"));
+    }
+    response_send(conn, &resp);
+    if (head_only || conn->closing) {
+        conn->closing |= !chunked;
+        return;
+    }
+    conn->stream = (response_stream_t){
+        .produce = produce, .chunked = chunked, .next = next, .end = end
+    };
+    stream_pump(conn);
+}
+
+static bool produce_lines(connection_t* conn) {
+    response_stream_t* stream = &conn->stream;
+    char buf[STREAM_CHUNK];
+    size_t len = 0;
+    while (stream->next < stream->end && len + 24 <= sizeof(buf)) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%llu\n",
+                        (unsigned long long)++stream->next);
+    }
+    return stream_write(conn, buf, len) && stream->next < stream->end;
+}
+
+// /stream?lines=N: the numbers 1 to N, a line each, generated as the
+// client reads them, so any length takes the same memory
+static void respond_lines(connection_t* conn, const http_request_t* req,
+                          const request_info_t* info) {
+    uint64_t lines = STREAM_LINES;
+    if (req->query.len > 0) {
+        http_slice_t value = { req->query.ptr + 6, req->query.len - 6 };
+        if (req->query.len <= 6 || value.len > 18 || memcmp(req->query.ptr, "lines=", 6) != 0) {
+            respond_empty(conn, info, "400 Bad Request", NULL);
+            return;
+        }
+        lines = 0;
+        for (size_t i = 0; i < value.len; i++) {
+            if (value.ptr[i] < '0' || value.ptr[i] > '9') {
+                respond_empty(conn, info, "400 Bad Request", NULL);
+                return;
+            }
+            lines = lines * 10 + (value.ptr[i] - '0');
+        }
+    }
+    respond_stream(conn, info, http_slice_eq(req->method, "HEAD"), STATIC_BLOCK(hello_head),
+                   produce_lines, 0, lines);
+}
+
+static bool checksum_data(connection_t* conn, http_slice_t data) {
+    conn->body.state = crc32(conn->body.state, (const Bytef*)data.ptr, data.len);
+    return true;
+}
+
+static void checksum_end(connection_t* conn) {
+    arena_str_t body = { .arena = &conn->arena };
+    arena_printf(&body, "%llu %08llx\n", (unsigned long long)conn->body.received,
+                 (unsigned long long)conn->body.state);
+    if (body.failed) {
+        respond_status(conn, "500 Internal Server Error");
+        return;
+    }
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK(hello_head));
+    response_add_date(&resp, conn->worker);
+    response_end_head(&resp, &conn->body.info, body.len);
+    response_add(&resp, body.data, body.len);
+    response_send(conn, &resp);
+}
+
+// POST /checksum: the length and CRC-32 of the request body, computed as
+// it arrives, so a body of any size is checked in constant memory
+static void respond_checksum(connection_t* conn, const http_request_t* req,
+                             const request_info_t* info) {
+    if (!http_slice_eq(req->method, "POST")) {
+        respond_empty(conn, info, "405 Method Not Allowed", "Allow: POST\r\n");
+        return;
+    }
+    conn->body.on_data = checksum_data;
+    conn->body.on_end = checksum_end;
+    conn->body.state = crc32(0, NULL, 0);
+}
+
+// a file write failed: the disk is full, or something else went wrong
+static const char* write_error_status(int err) {
+    return err == ENOSPC || err == EDQUOT ? "507 Insufficient Storage"
+                                          : "500 Internal Server Error";
+}
+
+// an upload in progress, in a buffer from the worker's pool: the body goes
+// to a temporary file in the upload directory, renamed once it is complete
+typedef struct {
+    int fd;
+    size_t cap;             // of this buffer, for buf_free()
+    char temp[48];
+    char name[NAME_MAX + 1];
+} upload_t;
+
+static void upload_free(connection_t* conn, upload_t* upload) {
+    buf_free(&conn->worker->buf_pool, (char*)upload, upload->cap);
+}
+
+// bytes that arrived with the head, and chunked bodies, which need
+// decoding, are written from the read buffer
+static bool upload_data(connection_t* conn, http_slice_t data) {
+    upload_t* upload = conn->body.ctx;
+    while (data.len > 0) {
+        ssize_t n = write(upload->fd, data.ptr, data.len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            log_errno("write upload");
+            respond_status(conn, write_error_status(errno));
+            return false;
+        }
+        data.ptr += n;
+        data.len -= n;
+    }
+    return true;
+}
+
+static void upload_abort(connection_t* conn) {
+    upload_t* upload = conn->body.ctx;
+    close(upload->fd);
+    unlinkat(upload_dir_fd, upload->temp, 0);
+    upload_free(conn, upload);
+}
+
+static void upload_end(connection_t* conn) {
+    upload_t* upload = conn->body.ctx;
+    struct stat st;
+    bool existed = fstatat(upload_dir_fd, upload->name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    if (close(upload->fd) == -1 ||
+        renameat(upload_dir_fd, upload->temp, upload_dir_fd, upload->name) == -1) {
+        log_errno("upload");
+        unlinkat(upload_dir_fd, upload->temp, 0);
+        respond_status(conn, write_error_status(errno));
+    } else {
+        metrics_add(&conn->worker->metrics->uploads, 1);
+        respond_empty(conn, &conn->body.info, existed ? "200 OK" : "201 Created", NULL);
+    }
+    upload_free(conn, upload);
+}
+
+// one path component that can't be a temporary file: letters, digits and
+// ".-_", not starting with a dot
+static bool upload_name_valid(http_slice_t name) {
+    if (name.len == 0 || name.len > NAME_MAX || name.ptr[0] == '.') {
+        return false;
+    }
+    for (size_t i = 0; i < name.len; i++) {
+        char c = name.ptr[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '.' || c == '-' || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// PUT /upload/NAME with --upload-dir: the body is stored as NAME there.
+// Nothing shows under NAME until all of it has arrived, and an upload cut
+// short leaves nothing behind. Once the bytes that came with the head are
+// written, the rest of a Content-Length body is spliced from the socket.
+static void respond_upload(connection_t* conn, const http_request_t* req,
+                           const request_info_t* info) {
+    if (!http_slice_eq(req->method, "PUT")) {
+        respond_empty(conn, info, "405 Method Not Allowed", "Allow: PUT\r\n");
+        return;
+    }
+    http_slice_t name = { req->path.ptr + 8, req->path.len - 8 };
+    if (!upload_name_valid(name)) {
+        respond_empty(conn, info, "400 Bad Request", NULL);
+        return;
+    }
+
+    worker_t* worker = conn->worker;
+    size_t cap;
+    upload_t* upload = (upload_t*)buf_alloc(&worker->buf_pool, sizeof(upload_t), &cap);
+    if (!upload) {
+        respond_status(conn, "500 Internal Server Error");
+        return;
+    }
+    upload->cap = cap;
+    memcpy(upload->name, name.ptr, name.len);
+    upload->name[name.len] = '\0';
+    snprintf(upload->temp, sizeof(upload->temp), ".upload-%d-%llu", worker->worker_id,
+             (unsigned long long)worker->uploads++);
+    upload->fd = openat(upload_dir_fd, upload->temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                        0644);
+    if (upload->fd == -1) {
+        log_errno("openat upload");
+        upload_free(conn, upload);
+        respond_status(conn, "500 Internal Server Error");
+        return;
+    }
+    // claim the space up front: a full disk is found before the client,
+    // waiting for 100 Continue, sends anything
+    if (!info->chunked && info->content_length > 0 &&
+        fallocate(upload->fd, 0, 0, info->content_length) == -1 &&
+        (errno == ENOSPC || errno == EDQUOT)) {
+        close(upload->fd);
+        unlinkat(upload_dir_fd, upload->temp, 0);
+        upload_free(conn, upload);
+        respond_empty(conn, info, "507 Insufficient Storage", NULL);
+        return;
+    }
+
+    conn->body.ctx = upload;
+    conn->body.on_data = upload_data;
+    conn->body.on_end = upload_end;
+    conn->body.on_abort = upload_abort;
+    conn->body.splice_fd = info->chunked ? -1 : upload->fd;
+}
+
+static void respond_hello(connection_t* conn, const request_info_t* req) {
+    worker_t* worker = conn->worker;
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK(hello_head));
+    response_add_date(&resp, worker);
+    response_end_head(&resp, req, worker->hello_len);
+    response_add(&resp, worker->hello, worker->hello_len);
+    response_send(conn, &resp);
+}
+
+static const char* const content_encoding_lines[COMPRESS_CODINGS] = {
+    "Content-Encoding: gzip\r\n",
+    "Content-Encoding: deflate\r\n",
+};
+
+// the coding to compress a response with, or -1 for none: whichever of
+// gzip and deflate the client weights higher, gzip on a tie
+static int negotiate_compression(const http_request_t* req) {
+    const http_slice_t* accept = http_find_header(req, "Accept-Encoding");
+    if (!accept) {
+        return -1;
+    }
+    int weights[COMPRESS_CODINGS];
+    accept_encoding_weights(*accept, compress_coding_names, COMPRESS_CODINGS, weights);
+    int best = -1;
+    int best_weight = 0;
+    for (int i = 0; i < COMPRESS_CODINGS; i++) {
+        if (weights[i] > best_weight) {
+            best = i;
+            best_weight = weights[i];
+        }
+    }
+    return best;
+}
+
+// a 200 with a body built for this request, head being its status and
+// Content-Type lines. A big enough body goes out compressed if the client
+// takes it, compressed for this response alone, so it can't push cached
+// files out of the compression cache.
+static void respond_body(connection_t* conn, const http_request_t* req,
+                         const request_info_t* info, const char* head, size_t head_len,
+                         const char* body, size_t body_len) {
+    worker_t* worker = conn->worker;
+    bool compressible = compress_max > 0 && body_len >= compress_min && body_len <= compress_max;
+    int coding = compressible ? negotiate_compression(req) : -1;
+    compressed_t* packed = NULL;
+    if (coding >= 0) {
+        metrics_add(&worker->metrics->compress_misses, 1);
+        packed = compress_body(&worker->compress, coding, body, body_len);
+    }
+
+    response_t resp = { .count = 0 };
+    response_add(&resp, head, head_len);
+    if (packed) {
+        response_add(&resp, content_encoding_lines[coding], strlen(content_encoding_lines[coding]));
+    }
+    if (compressible) {
+        response_add(&resp, STATIC_BLOCK("Vary: Accept-Encoding\r\n"));
+    }
+    response_add_date(&resp, worker);
+    if (!packed) {
+        response_end_head(&resp, info, body_len);
+        response_add(&resp, body, body_len);
+        response_send(conn, &resp);
+        return;
+    }
+    response_end_head(&resp, info, packed->len);
+    response_send(conn, &resp);
+    if (!conn->closing && !output_compressed(conn, packed)) {
+        conn->closing = true;
+    }
+    compressed_release(packed);
+}
+
+// every worker's counters in Prometheus text format; the body stays in the
+// arena until it has been written
+static void respond_metrics(connection_t* conn, const http_request_t* req,
+                            const request_info_t* info) {
+    size_t body_len;
+    char* body = metrics_render(&conn->arena, &body_len);
+    if (!body) {
+        respond_status(conn, "500 Internal Server Error");
+        return;
+    }
+    respond_body(conn, req, info, STATIC_BLOCK(metrics_head), body, body_len);
+}
+
+// the status line and file headers of a hot object are always copied, so
+// only its body needs the object held
+_Static_assert(sizeof("HTTP/1.1 200 OK\r\n") - 1 + FILE_HEADERS_MAX < OUTPUT_COPY_MAX,
+               "hot object heads must be copied");
+
+// a small file from the shared hot cache: the stored head, this request's
+// Date and framing lines, then the body, all in one writev
+static void respond_hot(connection_t* conn, const request_info_t* req, hot_object_t* obj) {
+    response_t resp = { .count = 0 };
+    response_add(&resp, obj->data, obj->head_len);
+    response_add_date(&resp, conn->worker);
+    response_end_head(&resp, req, obj->body_len);
+    response_send(conn, &resp);
+    if (!conn->closing && !output_hot(conn, obj)) {
+        conn->closing = true;
+    }
+}
+
+// the client's copy is current: validators but no body, and none of
+// Content-Type, Content-Encoding or Content-Length, which describe the 200
+static void respond_not_modified(connection_t* conn, const request_info_t* req,
+                                 const file_entry_t* file) {
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK("HTTP/1.1 304 Not Modified\r\n"));
+    response_add_date(&resp, conn->worker);
+    response_add(&resp, file->headers + file->meta_len, file->headers_len - file->meta_len);
+    response_finish_head(&resp, req);
+    response_send(conn, &resp);
+}
+
+// one range of a file, sent with sendfile() from its offset
+static void respond_range(connection_t* conn, const request_info_t* req, file_entry_t* file,
+                          const byte_range_t* range) {
+    char content_range[80];
+    int n = snprintf(content_range, sizeof(content_range),
+                     "Content-Range: bytes %lld-%lld/%lld\r\n", (long long)range->start,
+                     (long long)(range->start + range->len - 1), (long long)file->size);
+
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK("HTTP/1.1 206 Partial Content\r\n"));
+    response_add_date(&resp, conn->worker);
+    response_add(&resp, file->headers, file->headers_len);
+    response_add(&resp, content_range, n);
+    response_end_head(&resp, req, range->len);
+    response_send(conn, &resp);
+    if (!conn->closing) {
+        output_file(conn, file, range->start, range->len);
+    }
+}
+
+// several ranges as multipart/byteranges: each part's small header block is
+// copied, its data goes out with sendfile(). The caller has checked that
+// the output queue has a segment for every piece.
+static void respond_multirange(connection_t* conn, const request_info_t* req, file_entry_t* file,
+                               const byte_range_t* ranges, int count) {
+    char boundary[17];
+    snprintf(boundary, sizeof(boundary), "%016llx",
+             (unsigned long long)(monotonic_ns() * 0x9e3779b97f4a7c15ULL));
+    const char* type = file->headers + 14;     // past "Content-Type: ", before its CRLF
+    int type_len = (int)file->type_len - 16;
+
+    char part_heads[RANGE_MAX][160];
+    int part_lens[RANGE_MAX];
+    size_t body_len = 0;
+    for (int i = 0; i < count; i++) {
+        part_lens[i] = snprintf(part_heads[i], sizeof(part_heads[i]),
+                                "\r\n--%s\r\nContent-Type: %.*s\r\n"
+                                "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                                boundary, type_len, type, (long long)ranges[i].start,
+                                (long long)(ranges[i].start + ranges[i].len - 1),
+                                (long long)file->size);
+        body_len += part_lens[i] + ranges[i].len;
+    }
+    char tail[32];
+    int tail_len = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", boundary);
+    body_len += tail_len;
+
+    char content_type[80];
+    int n = snprintf(content_type, sizeof(content_type),
+                     "Content-Type: multipart/byteranges; boundary=%s\r\n", boundary);
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK("HTTP/1.1 206 Partial Content\r\n"));
+    response_add_date(&resp, conn->worker);
+    response_add(&resp, content_type, n);
+    response_add(&resp, file->headers + file->type_len, file->headers_len - file->type_len);
+    response_end_head(&resp, req, body_len);
+    response_send(conn, &resp);
+
+    for (int i = 0; i < count && !conn->closing; i++) {
+        if (!output_append(conn, part_heads[i], part_lens[i])) {
+            conn->closing = true;
+            return;
+        }
+        output_file(conn, file, ranges[i].start, ranges[i].len);
+    }
+    if (!conn->closing && !output_append(conn, tail, tail_len)) {
+        conn->closing = true;
+    }
+}
+
+// a file compressed on the fly, from the worker's cache when its content
+// was compressed before. The tag is weak, as the bytes depend on the zlib
+// build as much as on the file. False if compressing failed, to send the
+// file as it is.
+static bool respond_compressed_file(connection_t* conn, const http_request_t* req,
+                                    const request_info_t* info, file_entry_t* file,
+                                    compress_coding_t coding, bool head) {
+    worker_t* worker = conn->worker;
+    char etag[80];
+    int etag_len = snprintf(etag, sizeof(etag), "ETag: W/%.*s-%s\"\r\n", (int)file->etag_len - 1,
+                            file->etag, compress_coding_names[coding]);
+    const char* tag = etag + 8;     // the quoted part the client echoes
+    cond_target_t target = { tag, etag_len - 10, file->mtime, 0 };
+    // ETag is the last of the file's header lines
+    size_t rest_len = file->headers_len - file->type_len - (file->etag_len + 8);
+
+    if (cond_not_modified(req, &target)) {
+        response_t resp = { .count = 0 };
+        response_add(&resp, STATIC_BLOCK("HTTP/1.1 304 Not Modified\r\n"));
+        response_add_date(&resp, worker);
+        response_add(&resp, file->headers + file->type_len, rest_len);
+        response_add(&resp, etag, etag_len);
+        response_finish_head(&resp, info);
+        response_send(conn, &resp);
+        return true;
+    }
+
+    compress_key_t key = { file->dev, file->ino, file->size, file->changed };
+    compressed_t* packed = compress_lookup(&worker->compress, coding, &key);
+    if (packed) {
+        metrics_add(&worker->metrics->compress_hits, 1);
+    } else {
+        metrics_add(&worker->metrics->compress_misses, 1);
+        packed = compress_file(&worker->compress, coding, file->fd, &key);
+        if (!packed) {
+            return false;
+        }
+    }
+
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK("HTTP/1.1 200 OK\r\n"));
+    response_add_date(&resp, worker);
+    response_add(&resp, file->headers, file->type_len);
+    response_add(&resp, content_encoding_lines[coding], strlen(content_encoding_lines[coding]));
+    response_add(&resp, file->headers + file->type_len, rest_len);
+    response_add(&resp, etag, etag_len);
+    response_end_head(&resp, info, packed->len);
+    response_send(conn, &resp);
+    if (!head && !conn->closing && !output_compressed(conn, packed)) {
+        conn->closing = true;
+    }
+    compressed_release(packed);
+    return true;
+}
+
+// the representation to send: of the sidecars smaller than the file, the
+// one whose coding the client weights highest, the smallest on a tie;
+// the file itself when the client takes none of them
+static file_entry_t* negotiate_encoding(const http_request_t* req, file_entry_t* file) {
+    int sidecars = 0;
+    for (int i = 0; i < FILE_ENCODINGS; i++) {
+        sidecars += file->encoded[i] != NULL;
+    }
+    const http_slice_t* accept = sidecars ? http_find_header(req, "Accept-Encoding") : NULL;
+    if (!accept) {
+        return file;
+    }
+
+    int weights[FILE_ENCODINGS];
+    accept_encoding_weights(*accept, file_encoding_names, FILE_ENCODINGS, weights);
+    file_entry_t* best = file;
+    int best_weight = 0;
+    for (int i = 0; i < FILE_ENCODINGS; i++) {
+        file_entry_t* sidecar = file->encoded[i];
+        if (sidecar && weights[i] > 0 && sidecar->size < file->size &&
+            (weights[i] > best_weight || (weights[i] == best_weight && sidecar->size < best->size))) {
+            best = sidecar;
+            best_weight = weights[i];
+        }
+    }
+    return best;
+}
+
+// a file under the document root: headers from the cache entry, the body
+// straight from the page cache with sendfile(); HEAD gets the headers only.
+// Validators, ranges and the hot cache all apply to the negotiated
+// representation, which a precompressed sidecar may stand in for.
+static void respond_file(connection_t* conn, const http_request_t* req,
+                         const request_info_t* info) {
+    bool head = http_slice_eq(req->method, "HEAD");
+    if (!head && !http_slice_eq(req->method, "GET")) {
+        respond_empty(conn, info, "405 Method Not Allowed", "Allow: GET, HEAD\r\n");
+        return;
+    }
+
+    file_entry_t* entry = file_cache_get(&conn->worker->files, req->path.ptr, req->path.len);
+    if (!entry) {
+        if (errno == ENOENT) {
+            respond_empty(conn, info, "404 Not Found", NULL);
+        } else if (errno == EACCES) {
+            respond_empty(conn, info, "403 Forbidden", NULL);
+        } else {
+            log_errno("file_cache_get");
+            respond_empty(conn, info, "500 Internal Server Error", NULL);
+        }
+        return;
+    }
+
+    file_entry_t* file = negotiate_encoding(req, entry);
+
+    // no sidecar the client takes: compress on the fly, unless a range asks
+    // for bytes of the file as it is
+    if (file == entry && file->compressible && !http_find_header(req, "Range")) {
+        int coding = negotiate_compression(req);
+        if (coding >= 0 && respond_compressed_file(conn, req, info, file, coding, head)) {
+            file_cache_release(entry);
+            return;
+        }
+    }
+
+    // validators first: a 304 or a range never needs the whole body
+    cond_target_t target = { file->etag, file->etag_len, file->mtime, file->size };
+    if (cond_not_modified(req, &target)) {
+        respond_not_modified(conn, info, file);
+        file_cache_release(entry);
+        return;
+    }
+    byte_range_t ranges[RANGE_MAX];
+    int count;
+    range_result_t range = head ? RANGE_NONE : range_evaluate(req, &target, ranges, &count);
+    if (range == RANGE_UNSATISFIABLE) {
+        char content_range[48];
+        snprintf(content_range, sizeof(content_range), "Content-Range: bytes */%lld\r\n",
+                 (long long)file->size);
+        respond_empty(conn, info, "416 Range Not Satisfiable", content_range);
+        file_cache_release(entry);
+        return;
+    }
+    // too many parts to queue behind what is already waiting: the whole
+    // body is a valid answer too. So it is for several ranges of encoded
+    // data, whose parts would have no way to say so.
+    if (range == RANGE_PARTIAL &&
+        (count == 1 || (!file->encoding && conn->seg_count + 2 * count + 2 <= OUTPUT_SEGMENTS))) {
+        if (count == 1) {
+            respond_range(conn, info, file, &ranges[0]);
+        } else {
+            respond_multirange(conn, info, file, ranges, count);
+        }
+        file_cache_release(entry);
+        return;
+    }
+
+    if (!head && hot_enabled && (size_t)file->size <= hot_cache.object_max) {
+        worker_metrics_t* metrics = conn->worker->metrics;
+        hot_object_t* obj = hot_cache_lookup(&hot_cache, file);
+        if (obj) {
+            metrics_add(&metrics->hot_hits, 1);
+        } else {
+            metrics_add(&metrics->hot_misses, 1);
+            obj = hot_cache_fill(&hot_cache, file);
+        }
+        if (obj) {
+            respond_hot(conn, info, obj);
+            file_cache_release(entry);
+            return;
+        }
+    }
+
+    response_t resp = { .count = 0 };
+    response_add(&resp, STATIC_BLOCK("HTTP/1.1 200 OK\r\n"));
+    response_add_date(&resp, conn->worker);
+    response_add(&resp, file->headers, file->headers_len);
+    response_end_head(&resp, info, file->size);
+    response_send(conn, &resp);
+    if (!head && !conn->closing) {
+        output_file(conn, file, 0, file->size);
+    }
+    file_cache_release(entry);
+}
+
+// note a chunk of input about to be appended to in_buf; a request's latency
+// is measured from the read that brought its first byte
+static void connection_received(connection_t* conn, size_t n) {
+    uint64_t now = monotonic_ns();
+    if (conn->in_len == 0 && conn->state == CONN_READ_HEADERS) {
+        conn->request_start = now;
+    }
+    conn->last_read = now;
+    conn->progress = true;
+    metrics_add(&conn->worker->metrics->bytes_in, n);
+}
+
+// a response has been queued; the next buffered request arrived no later
+// than the last read
+static void request_done(connection_t* conn) {
+    metrics_record_latency(conn->worker->metrics, monotonic_ns() - conn->request_start);
+    conn->request_start = conn->last_read;
+    conn->timeout_kind = TIMEOUT_NONE;  // the next request gets a fresh deadline
+}
+
+// arm the timeout for whatever the connection is waiting on. Every phase
+// but the request head restarts on progress, so a slow body or a slow
+// reader survives as long as bytes move, while a head trickled in a byte at
+// a time still hits its deadline.
+static void connection_update_timer(connection_t* conn) {
+    timeout_kind_t kind;
+    uint64_t timeout_ms;
+
+    if (output_pending(conn) > 0) {
+        kind = TIMEOUT_WRITE;
+        timeout_ms = WRITE_TIMEOUT_MS;
+    } else if (conn->state == CONN_READ_BODY) {
+        kind = TIMEOUT_BODY;
+        timeout_ms = BODY_TIMEOUT_MS;
+    } else if (conn->in_len > 0) {
+        kind = TIMEOUT_HEADER;
+        timeout_ms = HEADER_TIMEOUT_MS;
+    } else {
+        kind = TIMEOUT_KEEPALIVE;
+        timeout_ms = KEEPALIVE_TIMEOUT_MS;
+    }
+
+    bool restart = kind != conn->timeout_kind || (conn->progress && kind != TIMEOUT_HEADER);
+    conn->progress = false;
+    if (restart) {
+        conn->timeout_kind = kind;
+        timer_schedule(&conn->worker->timers, &conn->timer, monotonic_ms() + timeout_ms);
+    }
+}
+
+// a body that can't be read to its end: the response says why, unless it
+// went out with the head already. Returns false, for the connection closes.
+static bool body_refused(connection_t* conn, const char* status) {
+    body_abandon(conn);
+    if (conn->body.on_end) {
+        respond_status(conn, status);
+        request_done(conn);
+    }
+    conn->state = CONN_READ_HEADERS;
+    return false;
+}
+
+// feed buffered body bytes through the framing decoder to the handler, or
+// past it when nobody wants them; false once the connection should close
+// after its queued output
+static bool consume_body(connection_t* conn, size_t* offset) {
+    request_body_t* body = &conn->body;
+    for (;;) {
+        size_t used;
+        http_slice_t data;
+        http_body_result_t rc = http_body_decode(&body->framing, conn->in_buf + *offset,
+                                                 conn->in_len - *offset, &used, &data);
+        *offset += used;
+        switch (rc) {
+        case HTTP_BODY_INCOMPLETE:
+            return true;
+        case HTTP_BODY_DONE:
+            conn->state = CONN_READ_HEADERS;
+            body->on_abort = NULL;
+            if (!body->on_end) {
+                return true;
+            }
+            body->on_end(conn);
+            request_done(conn);
+            return body->info.keep_alive;
+        case HTTP_BODY_BAD:
+            metrics_add(&conn->worker->metrics->parse_errors, 1);
+            return body_refused(conn, "400 Bad Request");
+        case HTTP_BODY_DATA:
+            body->received += data.len;
+            if (body->received > max_body) {
+                return body_refused(conn, "413 Content Too Large");
+            }
+            if (body->on_data && !body->on_data(conn, data)) {
+                body_abandon(conn);
+                request_done(conn);
+                conn->state = CONN_READ_HEADERS;
+                return false;
+            }
+            break;
+        }
+    }
+}
+
+// parse and answer buffered requests in order, stopping early while the
+// output queue is full; returns false once the
+// connection should be closed after its queued output
+static bool process_input(connection_t* conn) {
+    size_t offset = 0;
+    bool keep_open = true;
+
+    while (keep_open && !input_blocked(conn)) {
+        if (conn->state == CONN_READ_BODY) {
+            keep_open = consume_body(conn, &offset);
+            if (conn->state == CONN_READ_BODY) {
+                break;
+            }
+            continue;
+        }
+
+        if (offset == conn->in_len) {
+            break;
+        }
+
+        // slices in req point into in_buf and stay valid until the compaction below
+        http_request_t req;
+        http_parse_result_t rc = http_parse_request(&conn->parser, conn->in_buf + offset,
+                                                    conn->in_len - offset, &req);
+        if (rc == HTTP_PARSE_INCOMPLETE) {
+            break;
+        }
+
+        request_info_t info;
+        const char* error = rc == HTTP_PARSE_DONE ? interpret_request(&req, &info)
+                                                  : parse_error_status(rc);
+        if (error) {
+            respond_status(conn, error);
+            metrics_add(&conn->worker->metrics->parse_errors, 1);
+            request_done(conn);
+            keep_open = false;
+            break;
+        }
+
+        // refused before it is sent, when the client waits for 100 Continue
+        if (!info.chunked && info.content_length > max_body) {
+            respond_status(conn, "413 Content Too Large");
+            request_done(conn);
+            keep_open = false;
+            break;
+        }
+        conn->body = (request_body_t){ .info = info, .splice_fd = -1 };
+        http_body_init(&conn->body.framing, info.chunked, info.content_length);
+        conn->state = CONN_READ_BODY;
 
-typedef struct {
-    int epoll_fd;
-    int worker_id;
-    pthread_t thread;
-} worker_t;
+        // most replies don't depend on the body, so they are queued now
+        // and the body is skipped afterwards. A client waiting for 100
+        // Continue won't send a body it has been answered without, so there
+        // is no telling where its next request starts: such a reply closes
+        // the connection.
+        bool has_body = info.chunked || info.content_length > 0;
+        if (info.expect_continue && has_body) {
+            info.keep_alive = false;
+        }
+        if (http_slice_eq(req.path, "/metrics")) {
+            respond_metrics(conn, &req, &info);
+        } else if (http_slice_eq(req.path, "/stream")) {
+            respond_lines(conn, &req, &info);
+        } else if (http_slice_eq(req.path, "/checksum")) {
+            respond_checksum(conn, &req, &info);
+        } else if (upload_dir && req.path.len > 8 && memcmp(req.path.ptr, "/upload/", 8) == 0) {
+            respond_upload(conn, &req, &info);
+        } else if (doc_root) {
+            respond_file(conn, &req, &info);
+        } else {
+            respond_hello(conn, &info);
+        }
+        offset += req.header_len;
 
-static worker_t* workers;
-static int num_workers = 0;
-static int server_fd;
-static volatile bool running = true;
+        if (conn->body.on_end) {
+            // answered once the body has been read
+            if (info.expect_continue && has_body &&
+                !output_append(conn, STATIC_BLOCK("HTTP/1.1 100 Continue\r\n\r\n"))) {
+                keep_open = false;
+            }
+        } else {
+            request_done(conn);
+            keep_open = info.keep_alive;
+        }
+    }
 
-static void* worker_thread(void* arg);
-static void setup_socket();
-static void handle_connection(int client_fd, int worker_id);
-static void signal_handler(int signum);
+    // keep only the unparsed tail, at the start of the buffer
+    if (offset > 0) {
+        memmove(conn->in_buf, conn->in_buf + offset, conn->in_len - offset);
+        conn->in_len -= offset;
+    }
+    return keep_open;
+}
 
-static void signal_handler(int signum) {
-    printf("\nReceived signal %d, shutting down...\n", signum);
-    running = false;
-    close(server_fd);  // This will break the accept loop
+// empty n bytes of the worker's pipe into fd. The pipe is shared by all of
+// the worker's uploads, so what can't be written is thrown away rather than
+// left for the next one.
+static bool splice_to_file(worker_t* worker, int fd, size_t n) {
+    while (n > 0) {
+        ssize_t moved = splice(worker->splice_pipe[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+        if (moved == -1 && errno == EINTR) {
+            continue;
+        }
+        if (moved <= 0) {
+            int err = moved == 0 ? EIO : errno;
+            char scratch[4096];
+            while (n > 0) {
+                ssize_t r = read(worker->splice_pipe[0], scratch,
+                                 n < sizeof(scratch) ? n : sizeof(scratch));
+                if (r <= 0) {
+                    break;
+                }
+                n -= r;
+            }
+            errno = err;
+            return false;
+        }
+        n -= moved;
+    }
+    return true;
 }
 
-static int make_socket_non_blocking(int sfd) {
-    int flags = fcntl(sfd, F_GETFL, 0);
-    if (flags == -1) {
-        perror("fcntl F_GETFL");
-        return -1;
+// move the rest of a Content-Length body from the socket to the file its
+// handler opened, through the worker's pipe, so the bytes never enter
+// userspace. True once all of it is there; false when the socket has no
+// more for now, or the upload failed and the connection is closing.
+static bool splice_body(connection_t* conn) {
+    worker_t* worker = conn->worker;
+    request_body_t* body = &conn->body;
+    for (;;) {
+        uint64_t remaining = http_body_unframed(&body->framing);
+        if (remaining == 0) {
+            return true;
+        }
+        size_t want = remaining < worker->splice_pipe_size ? remaining : worker->splice_pipe_size;
+        ssize_t n = splice(conn->fd, NULL, worker->splice_pipe[1], NULL, want,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            log_debug("Worker %d: Client closed connection mid-upload", worker->worker_id);
+            conn->closing = true;
+            return false;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                metrics_add(&worker->metrics->io_errors, 1);
+                log_errno("splice");
+                conn->closing = true;
+            }
+            return false;
+        }
+        connection_received(conn, n);
+        if (!splice_to_file(worker, body->splice_fd, n)) {
+            log_errno("splice upload");
+            body_refused(conn, write_error_status(errno));
+            conn->closing = true;
+            return false;
+        }
+        metrics_add(&worker->metrics->bytes_spliced, n);
+        http_body_skip(&body->framing, n);
+        body->received += n;
     }
-    if (fcntl(sfd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        perror("fcntl F_SETFL O_NONBLOCK");
-        return -1;
+}
+
+// drain the socket until EAGAIN (required under EPOLLET), answering
+// requests as they complete; reading pauses while the output queue is
+// full so a client that doesn't read its responses can't grow it further
+static void read_input(connection_t* conn) {
+    int worker_id = conn->worker->worker_id;
+
+    conn->read_paused = false;
+    if (!process_input(conn)) {
+        conn->closing = true;
+        return;
+    }
+
+    while (!conn->closing) {
+        if (input_blocked(conn)) {
+            conn->read_paused = true;
+            break;
+        }
+
+        // the rest of an upload goes from the socket to its file, unread
+        if (conn->state == CONN_READ_BODY && conn->body.splice_fd >= 0 && conn->in_len == 0 &&
+            http_body_unframed(&conn->body.framing) > 0) {
+            if (!splice_body(conn)) {
+                break;
+            }
+            if (!process_input(conn)) {
+                conn->closing = true;
+            }
+            continue;
+        }
+
+        if (conn->in_len == conn->in_cap) {
+            if (conn->in_cap >= MAX_HEADER_SIZE) {
+                respond_status(conn, "431 Request Header Fields Too Large");
+                metrics_add(&conn->worker->metrics->parse_errors, 1);
+                request_done(conn);
+                conn->closing = true;
+                break;
+            }
+            char* grown = buf_resize(&conn->worker->buf_pool, conn->in_buf, conn->in_len,
+                                     &conn->in_cap, conn->in_cap * 2);
+            if (!grown) {
+                log_errno("buf_resize");
+                conn->closing = true;
+                break;
+            }
+            conn->in_buf = grown;
+        }
+
+        ssize_t bytes_read = read(conn->fd, conn->in_buf + conn->in_len, conn->in_cap - conn->in_len);
+
+        if (bytes_read > 0) {
+            log_debug("Worker %d received: %.*s", worker_id, (int)bytes_read, conn->in_buf + conn->in_len);
+            connection_received(conn, bytes_read);
+            conn->in_len += bytes_read;
+            if (!process_input(conn)) {
+                conn->closing = true;
+            }
+        } else if (bytes_read == 0) {
+            // closed connection; answers to what was already received still go out
+            log_debug("Worker %d: Client closed connection", worker_id);
+            conn->closing = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                metrics_add(&conn->worker->metrics->io_errors, 1);
+                log_errno("read");
+                conn->closing = true;
+            }
+            break;
+        }
     }
-    return 0;
 }
 
-static void* worker_thread(void* arg) {
-    worker_t* worker = (worker_t*)arg;
-    struct epoll_event events[MAX_EVENTS];
+static void handle_connection(connection_t* conn, uint32_t events) {
+    if (events & EPOLLERR) {
+        log_debug("Worker %d: Client disconnected", conn->worker->worker_id);
+        connection_close(conn);
+        return;
+    }
+
+    bool can_read = !conn->closing && (events & (EPOLLIN | EPOLLHUP));
+    int flushes = 0;
+    for (;;) {
+        if (can_read) {
+            read_input(conn);
+        }
+        stream_pump(conn);
+        if (!connection_flush(conn)) {
+            connection_close(conn);
+            return;
+        }
+        // the socket took everything and the stream has more: no EPOLLOUT
+        // will come, so keep going, but queue up behind the other
+        // connections every so often
+        if (conn->stream.produce && output_pending(conn) == 0) {
+            if (++flushes < STREAM_BURST) {
+                continue;
+            }
+            if (!conn->ready) {
+                conn->ready = true;
+                conn->ready_next = conn->worker->stream_ready;
+                conn->worker->stream_ready = conn;
+            }
+            break;
+        }
+        // the queue drained below the limit: pick up where reading stopped,
+        // since edge-triggered epoll won't report the unread bytes again
+        can_read = conn->read_paused && !conn->closing && !input_blocked(conn);
+        if (!can_read) {
+            break;
+        }
+    }
+
+    if (conn->closing && output_pending(conn) == 0 && !conn->stream.produce) {
+        connection_close(conn);
+        return;
+    }
+    connection_update_timer(conn);
+}
+
+// io_uring backend: every worker runs its own ring with a multishot accept
+// on its listener, a multishot recv per connection fed from a provided
+// buffer ring, and at most one send in flight per connection. All SQEs
+// queued while handling a batch of completions go out in one io_uring_enter.
+
+enum {
+    URING_OP_ACCEPT,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_CANCEL,
+};
+
+#define URING_OP_MASK 7ULL  // connection_t is at least 8-byte aligned
+
+static inline uint64_t uring_data(connection_t* conn, int op) {
+    return (uint64_t)(uintptr_t)conn | (uint64_t)op;
+}
+
+static void uring_arm_accept(worker_t* worker) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    if (!sqe) {
+        log_error("Worker %d: submission queue full, accept not armed", worker->worker_id);
+        return;
+    }
+    int fd = worker->listen_fd != -1 ? worker->listen_fd : server_fd;
+    uring_prep_multishot_accept(sqe, fd, uring_data(NULL, URING_OP_ACCEPT));
+}
+
+static void uring_arm_recv(connection_t* conn) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&conn->worker->ring);
+    if (!sqe) {
+        conn->dead = true;
+        return;
+    }
+    uring_prep_multishot_recv(sqe, conn->fd, URING_BGID, uring_data(conn, URING_OP_RECV));
+    conn->recv_armed = true;
+    conn->ops_inflight++;
+}
+
+static void uring_cancel_recv(connection_t* conn) {
+    if (!conn->recv_armed || conn->recv_cancelled) {
+        return;
+    }
+    struct io_uring_sqe* sqe = uring_get_sqe(&conn->worker->ring);
+    if (!sqe) {
+        return;
+    }
+    uring_prep_cancel(sqe, uring_data(conn, URING_OP_RECV), uring_data(NULL, URING_OP_CANCEL));
+    conn->recv_cancelled = true;
+}
+
+static void uring_start_send(connection_t* conn) {
+    if (conn->send_inflight) {
+        return;
+    }
+    if (conn->send_off == conn->send_len) {
+        if (conn->out_len == conn->out_off) {
+            return;
+        }
+        // hand the queued bytes to the kernel; later output goes to the other buffer
+        char* buf = conn->send_buf;
+        size_t cap = conn->send_cap;
+        conn->send_buf = conn->out_buf;
+        conn->send_cap = conn->out_cap;
+        conn->send_off = conn->out_off;
+        conn->send_len = conn->out_len;
+        conn->out_buf = buf;
+        conn->out_cap = cap;
+        conn->out_off = conn->out_len = 0;
+    }
+
+    struct io_uring_sqe* sqe = uring_get_sqe(&conn->worker->ring);
+    if (!sqe) {
+        conn->dead = true;
+        return;
+    }
+    uring_prep_send(sqe, conn->fd, conn->send_buf + conn->send_off,
+                    conn->send_len - conn->send_off, uring_data(conn, URING_OP_SEND));
+    conn->send_inflight = true;
+    conn->ops_inflight++;
+}
+
+// bring a connection's outstanding operations in line with its state;
+// called after every completion that touched it
+static void uring_conn_update(connection_t* conn) {
+    if (!conn->dead) {
+        if (conn->read_paused && !input_blocked(conn)) {
+            conn->read_paused = false;
+            if (!conn->closing && !process_input(conn)) {
+                conn->closing = true;
+            }
+        }
+        // each completion refills a streaming body up to the limit
+        stream_pump(conn);
+        if (!conn->closing && input_blocked(conn)) {
+            // same backpressure as epoll: stop receiving until the queue drains
+            conn->read_paused = true;
+            uring_cancel_recv(conn);
+        }
+        if (!conn->closing && !conn->read_paused && !conn->recv_armed) {
+            uring_arm_recv(conn);
+        }
+        uring_start_send(conn);
+        if (conn->closing && output_pending(conn) == 0 && !conn->stream.produce) {
+            conn->dead = true;
+        } else {
+            connection_update_timer(conn);
+        }
+    }
+
+    if (conn->dead) {
+        uring_cancel_recv(conn);
+        if (conn->ops_inflight == 0) {
+            connection_close(conn);
+        }
+    }
+}
+
+static void uring_on_accept(worker_t* worker, const struct io_uring_cqe* cqe) {
+    if (cqe->res >= 0) {
+        connection_t* conn = connection_create(worker, cqe->res);
+        if (!conn) {
+            log_errno("connection_create");
+            close(cqe->res);
+        } else {
+            log_debug("New connection accepted by worker %d", worker->worker_id);
+            uring_conn_update(conn);
+        }
+    } else if (cqe->res != -ECANCELED) {
+        log_error("accept: %s", strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && running) {
+        uring_arm_accept(worker);
+    }
+}
+
+static void uring_on_recv(connection_t* conn, const struct io_uring_cqe* cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        // the multishot recv has ended, for whatever reason
+        conn->ops_inflight--;
+        conn->recv_armed = false;
+        conn->recv_cancelled = false;
+    }
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        uring_buf_ring_t* bufs = &conn->worker->recv_bufs;
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        size_t n = cqe->res;
+
+        if (!conn->dead) {
+            if (conn->in_len + n > conn->in_cap) {
+                size_t size = conn->in_cap;
+                while (size < conn->in_len + n) size *= 2;
+                // completions that were already queued when reading paused
+                // still arrive; they are bounded by the buffer ring and must
+                // be kept, so the header limit only applies while reading
+                char* grown = size <= 2 * MAX_HEADER_SIZE || conn->read_paused
+                    ? buf_resize(&conn->worker->buf_pool, conn->in_buf, conn->in_len,
+                                 &conn->in_cap, size)
+                    : NULL;
+                if (!grown) {
+                    conn->dead = true;
+                } else {
+                    conn->in_buf = grown;
+                }
+            }
+            if (!conn->dead) {
+                connection_received(conn, n);
+                memcpy(conn->in_buf + conn->in_len, uring_buf_ring_addr(bufs, bid), n);
+                log_debug("Worker %d received: %.*s", conn->worker->worker_id, (int)n,
+                          conn->in_buf + conn->in_len);
+                conn->in_len += n;
+            }
+        }
+        uring_buf_ring_recycle(bufs, bid);
+
+        if (!conn->dead && !conn->closing && !conn->read_paused && !process_input(conn)) {
+            conn->closing = true;
+        }
+    } else if (cqe->res == 0) {
+        log_debug("Worker %d: Client closed connection", conn->worker->worker_id);
+        conn->closing = true;
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        // -ENOBUFS: the buffer ring ran dry, the recv is simply re-armed
+        metrics_add(&conn->worker->metrics->io_errors, 1);
+        if (cqe->res != -ECONNRESET) {
+            log_error("recv: %s", strerror(-cqe->res));
+        }
+        conn->dead = true;
+    }
+
+    uring_conn_update(conn);
+}
+
+static void uring_on_send(connection_t* conn, const struct io_uring_cqe* cqe) {
+    conn->ops_inflight--;
+    conn->send_inflight = false;
+
+    if (cqe->res < 0) {
+        metrics_add(&conn->worker->metrics->io_errors, 1);
+        if (cqe->res != -EPIPE && cqe->res != -ECONNRESET) {
+            log_error("send: %s", strerror(-cqe->res));
+        }
+        conn->dead = true;
+    } else {
+        conn->send_off += cqe->res;
+        conn->progress = true;
+        metrics_add(&conn->worker->metrics->bytes_out, cqe->res);
+        if (conn->send_off == conn->send_len) {
+            conn->send_off = conn->send_len = 0;
+        }
+        if (output_pending(conn) == 0) {
+            output_drained(conn);
+        }
+    }
+
+    uring_conn_update(conn);
+}
 
-    printf("Worker %d started\n", worker->worker_id);
+static void uring_worker_loop(worker_t* worker) {
+    uring_arm_accept(worker);
 
     while (running) {
-        int n = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, 1000);
-        
-        if (n == -1) {
-            if (errno == EINTR) continue;  // Interrupted system call
-            perror("epoll_wait");
+        int timeout = timer_wheel_timeout(&worker->timers, monotonic_ms(), 1000);
+        int ret = uring_submit_and_wait(&worker->ring, 1, timeout);
+        if (ret < 0 && ret != -EBUSY && ret != -EAGAIN) {
+            log_error("io_uring_enter: %s", strerror(-ret));
             break;
         }
 
-        for (int i = 0; i < n; i++) {
-            if (events[i].events & EPOLLIN) {
-                handle_connection(events[i].data.fd, worker->worker_id);
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek_cqe(&worker->ring))) {
+            struct io_uring_cqe done = *cqe;
+            uring_cqe_seen(&worker->ring);
+
+            connection_t* conn = (connection_t*)(uintptr_t)(done.user_data & ~URING_OP_MASK);
+            switch (done.user_data & URING_OP_MASK) {
+            case URING_OP_ACCEPT:
+                uring_on_accept(worker, &done);
+                break;
+            case URING_OP_RECV:
+                uring_on_recv(conn, &done);
+                break;
+            case URING_OP_SEND:
+                uring_on_send(conn, &done);
+                break;
+            default:
+                break;
+            }
+        }
+        timer_wheel_advance(&worker->timers, monotonic_ms(), connection_timed_out);
+    }
+}
+
+static const char* const timeout_names[] = { "none", "keep-alive", "header", "body", "write" };
+
+// a connection sat in one phase for too long: drop it without a response,
+// the way a stalled client would see a reset
+static void connection_timed_out(wheel_timer_t* timer) {
+    connection_t* conn = (connection_t*)((char*)timer - offsetof(connection_t, timer));
+    log_debug("Worker %d: %s timeout, closing connection", conn->worker->worker_id,
+              timeout_names[conn->timeout_kind]);
+    metrics_add(&conn->worker->metrics->timeouts, 1);
+
+    if (backend == BACKEND_URING) {
+        // in-flight recv and send complete with errors once the socket is
+        // shut down; the connection is freed after the last of them
+        shutdown(conn->fd, SHUT_RDWR);
+        conn->dead = true;
+        uring_conn_update(conn);
+    } else {
+        connection_close(conn);
+    }
+}
+
+// set up a ring and recv buffer ring per worker; false (with nothing left
+// allocated) if the kernel lacks what the backend needs
+static bool setup_uring_workers(void) {
+    for (int i = 0; i < num_workers; i++) {
+        int err = uring_init(&workers[i].ring, URING_ENTRIES);
+        if (err == 0) {
+            err = uring_buf_ring_setup(&workers[i].ring, &workers[i].recv_bufs,
+                                       URING_RECV_BUFFERS, BUFFER_SIZE, URING_BGID);
+            if (err != 0) {
+                uring_exit(&workers[i].ring);
             }
-            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
-                printf("Worker %d: Client disconnected\n", worker->worker_id);
-                epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, events[i].data.fd, NULL);
-                close(events[i].data.fd);
+        }
+        if (err != 0) {
+            log_warn("io_uring unavailable (%s), falling back to epoll", strerror(-err));
+            for (int j = 0; j < i; j++) {
+                uring_buf_ring_free(&workers[j].ring, &workers[j].recv_bufs);
+                uring_exit(&workers[j].ring);
             }
+            return false;
         }
     }
+    return true;
+}
 
-    return NULL;
+// active connections plus those still waiting in the handoff queue, so
+// back-to-back accepts see each other before the worker has caught up
+static uint64_t worker_load(const worker_t* worker) {
+    const handoff_queue_t* q = worker->handoff;
+    uint32_t queued = q->tail - __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    return __atomic_load_n(&worker->metrics->active_connections, __ATOMIC_RELAXED) + queued;
 }
 
-static void handle_connection(int client_fd, int worker_id) {
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read = read(client_fd, buffer, sizeof(buffer) - 1);
-    
-    if (bytes_read > 0) {
-        buffer[bytes_read] = '\0';
-        printf("Worker %d received: %s", worker_id, buffer);
-
-        // simple HTTP response
-        const char* response = "HTTP/1.1 200 OK\r\n"
-                             "Content-Type: text/plain\r\n"
-                             "Connection: close\r\n"
-                             "\r\n"
-                             "Hello from worker %d!\n";
-        
-        char formatted_response[512];
-        snprintf(formatted_response, sizeof(formatted_response), response, worker_id);
-        write(client_fd, formatted_response, strlen(formatted_response));
-        close(client_fd);
-    } else if (bytes_read == 0) {
-        // closed connection
-        printf("Worker %d: Client closed connection\n", worker_id);
-    } else {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            perror("read");
+// choose the worker for a connection accepted by the main thread
+static worker_t* pick_worker(void) {
+    static int next = 0;
+    static uint32_t rng = 2463534242u;
+
+    switch (dispatch) {
+    case DISPATCH_LEAST_CONN: {
+        // scan from a rotating start so ties don't all land on worker 0
+        int best = next;
+        for (int i = 1; i < num_workers; i++) {
+            int candidate = (next + i) % num_workers;
+            if (worker_load(&workers[candidate]) < worker_load(&workers[best])) {
+                best = candidate;
+            }
+        }
+        next = (next + 1) % num_workers;
+        return &workers[best];
+    }
+    case DISPATCH_P2C: {
+        if (num_workers == 1) {
+            return &workers[0];
         }
+        // xorshift32; only the acceptor thread calls this
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        int a = rng % num_workers;
+        int b = (rng >> 16) % (num_workers - 1);
+        if (b >= a) {
+            b++;
+        }
+        return &workers[worker_load(&workers[b]) < worker_load(&workers[a]) ? b : a];
+    }
+    case DISPATCH_ROUND_ROBIN:
+    default: {
+        worker_t* worker = &workers[next];
+        next = (next + 1) % num_workers;
+        return worker;
+    }
     }
 }
 
-// setup main server socket
-static void setup_socket() {
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1) {
+// setup a listening socket; with reuseport every worker binds its own and
+// the kernel load-balances incoming connections between them
+static int create_listen_socket(bool reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
         perror("socket");
         exit(EXIT_FAILURE);
     }
 
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
         perror("setsockopt SO_REUSEADDR");
         exit(EXIT_FAILURE);
     }
 
-    if (make_socket_non_blocking(server_fd) == -1) {
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
+
+    if (make_socket_non_blocking(fd) == -1) {
         exit(EXIT_FAILURE);
     }
 
@@ -138,44 +2478,283 @@ static void setup_socket() {
         .sin_port = htons(PORT)
     };
 
-    if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+    if (bind(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
         perror("bind");
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_fd, MAX_CONNECTIONS) == -1) {
+    if (listen(fd, LISTEN_BACKLOG) == -1) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
-    printf("Server listening on port %d\n", PORT);
+    return fd;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -r, --reuseport        one SO_REUSEPORT listener per worker instead of a\n"
+            "                         single accept loop in the main thread\n"
+            "  -b, --backend NAME     epoll (default) or uring; uring falls back to\n"
+            "                         epoll if the kernel doesn't support it\n"
+            "  -d, --dispatch POLICY  how the accept loop spreads connections: rr\n"
+            "                         (round-robin, default), least-conn or p2c\n"
+            "                         (power of two choices on active connections)\n"
+            "  -R, --root DIR         serve files under DIR instead of the hello page\n"
+            "  -U, --upload-dir DIR   store the body of PUT /upload/NAME as DIR/NAME\n"
+            "  -C, --hot-cache SIZE   memory for whole small responses shared by all\n"
+            "                         workers with --root (default 32M, 0 disables)\n"
+            "  -M, --hot-object-max SIZE\n"
+            "                         largest file kept in the hot cache (default 64K)\n"
+            "  -Z, --compress-cache SIZE\n"
+            "                         memory per worker for gzip/deflate output compressed\n"
+            "                         on the fly (default 8M, 0 turns compression off)\n"
+            "  -z, --compress-min SIZE\n"
+            "                         smallest body compressed on the fly (default 1K)\n"
+            "  -B, --max-body SIZE    largest request body taken (default 1M); a larger\n"
+            "                         one gets 413 Content Too Large\n"
+            "  -l, --log-level LEVEL  error, warn, info (default) or debug\n"
+            "  -h, --help             show this help\n",
+            prog);
+}
+
+// a byte count with an optional K, M or G suffix
+static bool parse_size(const char* arg, size_t* size) {
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (errno != 0 || end == arg || arg[0] == '-') {
+        return false;
+    }
+    if (*end == 'K' || *end == 'k') {
+        n <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        n <<= 20;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        n <<= 30;
+        end++;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    *size = n;
+    return true;
+}
+
+static void parse_args(int argc, char* argv[]) {
+    static const struct option long_opts[] = {
+        {"reuseport", no_argument, NULL, 'r'},
+        {"backend", required_argument, NULL, 'b'},
+        {"dispatch", required_argument, NULL, 'd'},
+        {"root", required_argument, NULL, 'R'},
+        {"upload-dir", required_argument, NULL, 'U'},
+        {"hot-cache", required_argument, NULL, 'C'},
+        {"hot-object-max", required_argument, NULL, 'M'},
+        {"compress-cache", required_argument, NULL, 'Z'},
+        {"compress-min", required_argument, NULL, 'z'},
+        {"max-body", required_argument, NULL, 'B'},
+        {"log-level", required_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "rb:d:R:U:C:M:Z:z:B:l:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            use_reuseport = true;
+            break;
+        case 'b':
+            if (strcmp(optarg, "epoll") == 0) {
+                backend = BACKEND_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                backend = BACKEND_URING;
+            } else {
+                fprintf(stderr, "unknown backend: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "rr") == 0) {
+                dispatch = DISPATCH_ROUND_ROBIN;
+            } else if (strcmp(optarg, "least-conn") == 0) {
+                dispatch = DISPATCH_LEAST_CONN;
+            } else if (strcmp(optarg, "p2c") == 0) {
+                dispatch = DISPATCH_P2C;
+            } else {
+                fprintf(stderr, "unknown dispatch policy: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            doc_root = optarg;
+            break;
+        case 'U':
+            upload_dir = optarg;
+            break;
+        case 'C':
+        case 'M':
+        case 'Z':
+        case 'z':
+        case 'B':
+            if (!parse_size(optarg, opt == 'C' ? &hot_cache_size :
+                                    opt == 'M' ? &hot_object_max :
+                                    opt == 'Z' ? &compress_cache_size :
+                                    opt == 'z' ? &compress_min : &max_body)) {
+                fprintf(stderr, "invalid size: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l':
+            initial_log_level = log_level_from_name(optarg);
+            if (initial_log_level < 0) {
+                fprintf(stderr, "unknown log level: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    parse_args(argc, argv);
+    log_init(initial_log_level);
+    log_thread_init("main");
+
     // setup signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);  // a peer that went away shows up as EPIPE instead
 
     num_workers = sysconf(_SC_NPROCESSORS_ONLN);
     if (num_workers <= 0 || num_workers > MAX_WORKERS) {
         num_workers = 4;  // Reasonable default
     }
+    // a quarter of the cache at most, so one body can't flush the rest
+    if (compress_cache_size > 0) {
+        compress_max = compress_cache_size / 4 < COMPRESS_BODY_MAX ? compress_cache_size / 4
+                                                                   : COMPRESS_BODY_MAX;
+    }
 
     workers = calloc(num_workers, sizeof(worker_t));
     if (!workers) {
         perror("calloc workers");
         exit(EXIT_FAILURE);
     }
+    if (metrics_init(num_workers) == -1) {
+        perror("metrics_init");
+        exit(EXIT_FAILURE);
+    }
 
-    setup_socket();
+    if (!use_reuseport) {
+        server_fd = create_listen_socket(false);
+    }
 
     for (int i = 0; i < num_workers; i++) {
         workers[i].worker_id = i;
-        workers[i].epoll_fd = epoll_create1(0);
-        if (workers[i].epoll_fd == -1) {
-            perror("epoll_create1");
+        workers[i].listen_fd = -1;
+        workers[i].epoll_fd = -1;
+        workers[i].metrics = metrics_worker(i);
+    }
+    if (doc_root) {
+        struct stat st;
+        if (stat(doc_root, &st) == -1 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "--root %s: not a directory\n", doc_root);
+            exit(EXIT_FAILURE);
+        }
+        // every worker keeps up to FILE_CACHE_ENTRIES files open
+        struct rlimit nofile;
+        if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+            nofile.rlim_cur = nofile.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &nofile);
+        }
+        if (hot_cache_size > 0) {
+            if (hot_cache_init(&hot_cache, hot_cache_size, hot_object_max, num_workers) == -1) {
+                perror("hot_cache_init");
+                exit(EXIT_FAILURE);
+            }
+            hot_enabled = true;
+        }
+        if (backend == BACKEND_URING) {
+            log_warn("--root serves files with sendfile(), which the io_uring backend "
+                     "doesn't do; using epoll");
+            backend = BACKEND_EPOLL;
+        }
+    }
+    if (upload_dir) {
+        upload_dir_fd = open(upload_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (upload_dir_fd == -1) {
+            fprintf(stderr, "--upload-dir %s: %s\n", upload_dir, strerror(errno));
             exit(EXIT_FAILURE);
         }
+        if (backend == BACKEND_URING) {
+            log_warn("--upload-dir stores bodies with splice(), which the io_uring backend "
+                     "doesn't do; using epoll");
+            backend = BACKEND_EPOLL;
+        }
+    }
+    if (backend == BACKEND_URING && !setup_uring_workers()) {
+        backend = BACKEND_EPOLL;
+    }
+
+    // the main thread only accepts for epoll workers sharing one listener;
+    // otherwise workers accept on their own and it just waits for a signal
+    bool main_accepts = backend == BACKEND_EPOLL && !use_reuseport;
+
+    pthread_barrier_init(&workers_ready, NULL, num_workers + 1);
+    for (int i = 0; i < num_workers; i++) {
+        if (use_reuseport) {
+            workers[i].listen_fd = create_listen_socket(true);
+        }
+
+        // io_uring workers accept on their listener (or the shared one) themselves
+        if (backend == BACKEND_EPOLL) {
+            workers[i].epoll_fd = epoll_create1(0);
+            if (workers[i].epoll_fd == -1) {
+                perror("epoll_create1");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (backend == BACKEND_EPOLL && use_reuseport) {
+            // the listener is the only entry without a connection attached
+            struct epoll_event event = {
+                .events = EPOLLIN,
+                .data.ptr = NULL
+            };
+            if (epoll_ctl(workers[i].epoll_fd, EPOLL_CTL_ADD, workers[i].listen_fd, &event) == -1) {
+                perror("epoll_ctl listen_fd");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (main_accepts) {
+            workers[i].handoff = aligned_alloc(POOL_CACHE_LINE, sizeof(handoff_queue_t));
+            workers[i].handoff_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (!workers[i].handoff || workers[i].handoff_fd == -1) {
+                perror("handoff queue");
+                exit(EXIT_FAILURE);
+            }
+            memset(workers[i].handoff, 0, sizeof(handoff_queue_t));
+
+            struct epoll_event event = {
+                .events = EPOLLIN,
+                .data.ptr = &handoff_tag
+            };
+            if (epoll_ctl(workers[i].epoll_fd, EPOLL_CTL_ADD, workers[i].handoff_fd, &event) == -1) {
+                perror("epoll_ctl handoff_fd");
+                exit(EXIT_FAILURE);
+            }
+        }
 
         if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
             perror("pthread_create");
@@ -183,10 +2762,46 @@ int main() {
         }
     }
 
-    printf("Server started with %d workers\n", num_workers);
+    // a worker that could not set up would still be handed connections and
+    // would hold up hot cache reclamation for good, so that is fatal
+    pthread_barrier_wait(&workers_ready);
+    pthread_barrier_destroy(&workers_ready);
+    if (__atomic_load_n(&worker_failed, __ATOMIC_RELAXED)) {
+        log_error("A worker failed to start, exiting");
+        log_shutdown();
+        exit(EXIT_FAILURE);
+    }
+
+    // how connections actually reach the workers, after any fallback to epoll
+    const char* accept_model;
+    if (main_accepts) {
+        accept_model = "single acceptor";
+    } else if (backend == BACKEND_EPOLL) {
+        accept_model = "per-worker reuseport listeners";
+    } else if (use_reuseport) {
+        accept_model = "multishot accept on per-worker reuseport listeners";
+    } else {
+        accept_model = "multishot accept on the shared listener in every worker";
+    }
+    log_info("Server listening on port %d", PORT);
+    log_info("Server started with %d workers (%s, %s backend)", num_workers, accept_model,
+             backend == BACKEND_URING ? "io_uring" : "epoll");
+
+    if (!main_accepts && dispatch != DISPATCH_ROUND_ROBIN) {
+        log_warn("--dispatch only applies to the main accept loop; the kernel spreads "
+                 "connections in reuseport and io_uring modes");
+    }
+    while (running && !main_accepts) {
+        sleep(1);
+    }
+
+    while (running && main_accepts) {
+        // wait for a connection instead of spinning on the non-blocking accept
+        struct pollfd pfd = { .fd = server_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) <= 0 || !running) {
+            continue;
+        }
 
-    int current_worker = 0;
-    while (running) {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
         
@@ -195,7 +2810,7 @@ int main() {
             if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
                 continue;
             }
-            perror("accept");
+            log_errno("accept");
             break;
         }
 
@@ -205,31 +2820,47 @@ int main() {
             continue;
         }
 
-        struct epoll_event event = {
-            .events = EPOLLIN | EPOLLET,  
-            .data.fd = client_fd
-        };
-
-        if (epoll_ctl(workers[current_worker].epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
-            perror("epoll_ctl");
+        worker_t* worker = pick_worker();
+        if (!handoff_push(worker, client_fd)) {
+            log_warn("Worker %d handoff queue full, dropping connection", worker->worker_id);
             close(client_fd);
             continue;
         }
 
-        printf("New connection from %s:%d assigned to worker %d\n",
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), current_worker);
-
-        current_worker = (current_worker + 1) % num_workers;
+        log_debug("New connection from %s:%d assigned to worker %d",
+               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), worker->worker_id);
     }
 
-    printf("Shutting down server...\n");
+    log_info("Shutting down server...");
     
     for (int i = 0; i < num_workers; i++) {
         pthread_join(workers[i].thread, NULL);
-        close(workers[i].epoll_fd);
+        if (workers[i].epoll_fd != -1) {
+            close(workers[i].epoll_fd);
+        }
+        if (backend == BACKEND_URING) {
+            uring_buf_ring_free(&workers[i].ring, &workers[i].recv_bufs);
+            uring_exit(&workers[i].ring);
+        }
+        if (workers[i].listen_fd != -1) {
+            close(workers[i].listen_fd);
+        }
+        if (workers[i].handoff) {
+            // fds the worker never picked up
+            for (uint32_t h = workers[i].handoff->head; h != workers[i].handoff->tail; h++) {
+                close(workers[i].handoff->fds[h & (HANDOFF_QUEUE_SIZE - 1)]);
+            }
+            close(workers[i].handoff_fd);
+            free(workers[i].handoff);
+        }
     }
 
+    if (hot_enabled) {
+        hot_cache_destroy(&hot_cache);
+    }
     free(workers);
-    printf("Server shutdown complete\n");
+    metrics_free();
+    log_info("Server shutdown complete");
+    log_shutdown();
     return 0;
 }
@@ -0,0 +1,879 @@
+#define _GNU_SOURCE  // memmem
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256
+#define MAX_PIPELINE 128
+#define READ_BUFFER_SIZE (64 * 1024)
+
+// latency histogram in nanoseconds: values below 2^HIST_SUB_BITS are exact,
+// above that every power of two is split into 2^HIST_SUB_BITS linear
+// buckets, so any recorded value is off by less than 1%
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} histogram_t;
+
+typedef struct {
+    uint64_t requests;
+    uint64_t bytes_read;
+    uint64_t connect_errors;
+    uint64_t read_errors;
+    uint64_t write_errors;
+    uint64_t status_errors;     // anything but 2xx
+    uint64_t unfinished;        // open loop: scheduled but unanswered at the end
+    uint64_t abandoned;         // in flight on a connection that failed or closed
+} stats_t;
+
+// where the parser is in the current response
+typedef enum {
+    READ_HEAD,
+    READ_BODY,                  // Content-Length bytes
+    READ_CHUNK_SIZE,            // chunked: the size line of the next chunk
+    READ_CHUNK_DATA,            // chunked: the chunk and its CRLF
+    READ_TRAILER                // chunked: trailer lines up to the empty one
+} read_state_t;
+
+struct thread_s;
+
+typedef struct {
+    int fd;
+    struct thread_s* thread;
+    bool connected;
+
+    // the requests on the wire, oldest first: when each was due (the
+    // schedule in open-loop mode) and when it was actually written
+    uint64_t sent_at[MAX_PIPELINE];
+    uint64_t written_at[MAX_PIPELINE];
+    unsigned sent_head;
+    unsigned inflight;
+    unsigned completed;         // responses on this connection so far
+
+    size_t out_pending;         // tail of the pipeline buffer still to write
+
+    char* in_buf;
+    size_t in_len;
+    read_state_t state;
+    size_t body_skip;           // body or chunk bytes of the current response still to discard
+} conn_t;
+
+typedef struct thread_s {
+    pthread_t handle;
+    int epoll_fd;
+    conn_t* conns;
+    int num_conns;
+    uint64_t deadline;
+    histogram_t latency;        // from the due time, corrected for coordinated omission
+    histogram_t service;        // from the actual write
+    stats_t stats;
+
+    // open loop: this thread's share of the rate, handed out round-robin
+    uint64_t interval;
+    uint64_t next_send;
+    int next_conn;
+} thread_t;
+
+typedef struct {
+    histogram_t latency;
+    histogram_t service;
+    stats_t stats;
+    double elapsed;
+} result_t;
+
+static struct sockaddr_in server_addr;
+static const char* host = "127.0.0.1";
+static int port = 8080;
+static const char* path = "/";
+static int num_connections = 50;
+static int num_threads = 2;
+static int duration_sec = 10;
+static int pipeline_depth = 1;
+static bool keep_alive = true;
+
+// open loop: a fixed total request rate instead of one request per response
+static double target_rate = 0;
+static double sweep_to = 0;
+static double sweep_step = 0;
+static int max_inflight;        // per connection; the pipeline depth in closed loop
+
+// max_inflight copies of the request back to back, so any number of
+// requests up to the depth is a tail of this buffer
+static char* pipeline_buf;
+static size_t request_len;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) {
+        return (int)value;
+    }
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + (int)((value >> shift) - HIST_SUB_COUNT);
+}
+
+// highest value that lands in the bucket
+static uint64_t hist_value(int index) {
+    int block = index / HIST_SUB_COUNT;
+    if (block == 0) {
+        return index;
+    }
+    int shift = block - 1;
+    uint64_t sub = index % HIST_SUB_COUNT + HIST_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+static void hist_record(histogram_t* h, uint64_t value) {
+    h->counts[hist_index(value)]++;
+    h->total++;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+static void hist_merge(histogram_t* into, const histogram_t* from) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    into->total += from->total;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+static uint64_t hist_percentile(const histogram_t* h, double percentile) {
+    uint64_t target = (uint64_t)(percentile / 100.0 * h->total + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t value = hist_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void format_duration(char* out, size_t size, uint64_t ns) {
+    if (ns < 1000) {
+        snprintf(out, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 1000000) {
+        snprintf(out, size, "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(out, size, "%.2fms", ns / 1e6);
+    } else {
+        snprintf(out, size, "%.2fs", ns / 1e9);
+    }
+}
+
+static void conn_close(conn_t* conn) {
+    if (conn->fd != -1) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn->connected = false;
+    conn->inflight = 0;
+    conn->completed = 0;
+    conn->sent_head = 0;
+    conn->out_pending = 0;
+    conn->in_len = 0;
+    conn->state = READ_HEAD;
+    conn->body_skip = 0;
+}
+
+static void conn_open(conn_t* conn) {
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn->fd == -1) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(conn->fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1 &&
+        errno != EINPROGRESS) {
+        conn->thread->stats.connect_errors++;
+    }
+
+    // edge-triggered: completion of the connect shows up as EPOLLOUT
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLET,
+        .data.ptr = conn
+    };
+    if (epoll_ctl(conn->thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// the requests still in flight on a connection about to be dropped never get
+// an answer: in open loop they count in latency with the time they waited,
+// like the unfinished ones at the end, instead of vanishing from it
+static void conn_abandon(conn_t* conn) {
+    thread_t* thread = conn->thread;
+    uint64_t now = now_ns();
+    for (unsigned i = 0; i < conn->inflight; i++) {
+        if (target_rate > 0) {
+            unsigned slot = (conn->sent_head + i) % MAX_PIPELINE;
+            hist_record(&thread->latency, now - conn->sent_at[slot]);
+        }
+        thread->stats.abandoned++;
+    }
+}
+
+static void conn_reconnect(conn_t* conn) {
+    conn_abandon(conn);
+    conn_close(conn);
+    conn_open(conn);
+}
+
+static void conn_queue(conn_t* conn, uint64_t due, uint64_t now) {
+    unsigned slot = (conn->sent_head + conn->inflight) % MAX_PIPELINE;
+    conn->sent_at[slot] = due;
+    conn->written_at[slot] = now;
+    conn->inflight++;
+    conn->out_pending += request_len;
+}
+
+static bool conn_write(conn_t* conn) {
+    size_t total = request_len * max_inflight;
+    while (conn->out_pending > 0) {
+        ssize_t n = write(conn->fd, pipeline_buf + total - conn->out_pending, conn->out_pending);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            conn->thread->stats.write_errors++;
+            return false;
+        }
+        conn->out_pending -= n;
+    }
+    return true;
+}
+
+static bool conn_can_send(const conn_t* conn) {
+    return conn->connected && conn->inflight < (unsigned)max_inflight &&
+           (keep_alive || conn->completed + conn->inflight == 0);
+}
+
+// closed loop: top the connection up to the pipeline depth
+static bool conn_send(conn_t* conn) {
+    uint64_t now = now_ns();
+    while (conn_can_send(conn)) {
+        conn_queue(conn, now, now);
+    }
+    return conn_write(conn);
+}
+
+static void complete_response(conn_t* conn, uint64_t now) {
+    thread_t* thread = conn->thread;
+    hist_record(&thread->latency, now - conn->sent_at[conn->sent_head]);
+    hist_record(&thread->service, now - conn->written_at[conn->sent_head]);
+    thread->stats.requests++;
+    conn->sent_head = (conn->sent_head + 1) % MAX_PIPELINE;
+    conn->inflight--;
+    conn->completed++;
+}
+
+// next CRLF-terminated line of a chunked body, NULL until all of it is in
+// sets *bad when it can never fit the input buffer
+static char* chunk_line(char* start, size_t avail, bool* bad) {
+    char* eol = memmem(start, avail, "\r\n", 2);
+    *bad = !eol && avail == READ_BUFFER_SIZE;
+    return eol;
+}
+
+// consume every complete response in the input buffer
+// returns false on a response that can't be parsed or has no framing
+static bool conn_parse(conn_t* conn, uint64_t now) {
+    size_t off = 0;
+    bool bad = false;
+
+    while (off < conn->in_len) {
+        char* start = conn->in_buf + off;
+        size_t avail = conn->in_len - off;
+
+        if (conn->state == READ_BODY || conn->state == READ_CHUNK_DATA) {
+            size_t n = avail < conn->body_skip ? avail : conn->body_skip;
+            conn->body_skip -= n;
+            off += n;
+            if (conn->body_skip > 0) {
+                continue;
+            }
+            if (conn->state == READ_BODY) {
+                conn->state = READ_HEAD;
+                complete_response(conn, now);
+            } else {
+                conn->state = READ_CHUNK_SIZE;
+            }
+            continue;
+        }
+
+        if (conn->state == READ_CHUNK_SIZE) {
+            char* eol = chunk_line(start, avail, &bad);
+            if (!eol) {
+                break;
+            }
+            char* digits_end;
+            unsigned long long size = strtoull(start, &digits_end, 16);
+            if (digits_end == start || (*digits_end != ';' && digits_end != eol)) {
+                return false;
+            }
+            off += eol + 2 - start;
+            if (size == 0) {
+                conn->state = READ_TRAILER;
+            } else {
+                conn->state = READ_CHUNK_DATA;
+                conn->body_skip = size + 2;
+            }
+            continue;
+        }
+
+        if (conn->state == READ_TRAILER) {
+            char* eol = chunk_line(start, avail, &bad);
+            if (!eol) {
+                break;
+            }
+            off += eol + 2 - start;
+            if (eol == start) {
+                conn->state = READ_HEAD;
+                complete_response(conn, now);
+            }
+            continue;
+        }
+
+        char* end = memmem(start, avail, "\r\n\r\n", 4);
+        if (!end) {
+            bad = avail == READ_BUFFER_SIZE;
+            break;
+        }
+        size_t head_len = end + 4 - start;
+
+        if (head_len < 12 || strncmp(start, "HTTP/1.", 7) != 0) {
+            return false;
+        }
+        if (start[9] != '2') {
+            conn->thread->stats.status_errors++;
+        }
+        // only GET is sent, so these are the statuses that never have a body
+        bool no_body = start[9] == '1' || strncmp(start + 9, "204", 3) == 0 ||
+                       strncmp(start + 9, "304", 3) == 0;
+
+        bool has_length = false;
+        bool chunked = false;
+        size_t content_length = 0;
+        for (char* line = memchr(start, '\n', head_len); line && line < end;
+             line = memchr(line, '\n', end - line)) {
+            line++;
+            if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                content_length = strtoul(line + 15, NULL, 10);
+                has_length = true;
+            } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+                char* eol = memchr(line, '\r', end + 2 - line);
+                chunked = eol && memmem(line + 18, eol - line - 18, "chunked", 7) != NULL;
+            }
+        }
+
+        off += head_len;
+        if (no_body || (!chunked && has_length && content_length == 0)) {
+            complete_response(conn, now);
+        } else if (chunked) {
+            conn->state = READ_CHUNK_SIZE;
+        } else if (has_length) {
+            conn->state = READ_BODY;
+            conn->body_skip = content_length;
+        } else {
+            // delimited by the close: the server didn't keep the connection
+            return false;
+        }
+    }
+
+    if (bad) {
+        return false;
+    }
+    conn->in_len -= off;
+    memmove(conn->in_buf, conn->in_buf + off, conn->in_len);
+    return true;
+}
+
+static void conn_handle(conn_t* conn, uint32_t events) {
+    thread_t* thread = conn->thread;
+
+    if (!conn->connected) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            thread->stats.connect_errors++;
+            conn_reconnect(conn);
+            return;
+        }
+        if (!(events & EPOLLOUT)) {
+            return;
+        }
+        conn->connected = true;
+    }
+
+    bool closed = false;
+    for (;;) {
+        ssize_t n = read(conn->fd, conn->in_buf + conn->in_len, READ_BUFFER_SIZE - conn->in_len);
+        if (n > 0) {
+            thread->stats.bytes_read += n;
+            conn->in_len += n;
+            if (!conn_parse(conn, now_ns())) {
+                thread->stats.read_errors++;
+                conn_reconnect(conn);
+                return;
+            }
+            continue;
+        }
+        if (n == 0) {
+            closed = true;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            thread->stats.read_errors++;
+            closed = true;
+        }
+        break;
+    }
+
+    if (!keep_alive && conn->completed > 0) {
+        // one request per connection
+        conn_reconnect(conn);
+        return;
+    }
+    if (closed) {
+        if (conn->inflight > 0 && keep_alive) {
+            thread->stats.read_errors++;
+        }
+        conn_reconnect(conn);
+        return;
+    }
+    if (!(target_rate > 0 ? conn_write(conn) : conn_send(conn))) {
+        conn_reconnect(conn);
+    }
+}
+
+// open loop: give every request whose scheduled time has passed to the next
+// connection that can take it. A request no connection can take stays due
+// and keeps its scheduled time, so a stalled server shows up as latency
+// instead of as the client quietly sending less.
+static void issue_scheduled(thread_t* thread, uint64_t now) {
+    int skipped = 0;
+    while (thread->next_send <= now && skipped < thread->num_conns) {
+        conn_t* conn = &thread->conns[thread->next_conn];
+        thread->next_conn = (thread->next_conn + 1) % thread->num_conns;
+        if (!conn_can_send(conn)) {
+            skipped++;
+            continue;
+        }
+        skipped = 0;
+        conn_queue(conn, thread->next_send, now);
+        thread->next_send += thread->interval;
+        if (!conn_write(conn)) {
+            conn_reconnect(conn);
+        }
+    }
+}
+
+// open loop: requests still unanswered at the end, in flight or never sent,
+// count with the time they have waited so far
+static void record_unfinished(thread_t* thread) {
+    for (int i = 0; i < thread->num_conns; i++) {
+        conn_t* conn = &thread->conns[i];
+        for (unsigned j = 0; j < conn->inflight; j++) {
+            unsigned slot = (conn->sent_head + j) % MAX_PIPELINE;
+            hist_record(&thread->latency, thread->deadline - conn->sent_at[slot]);
+            thread->stats.unfinished++;
+        }
+    }
+    for (; thread->next_send < thread->deadline; thread->next_send += thread->interval) {
+        hist_record(&thread->latency, thread->deadline - thread->next_send);
+        thread->stats.unfinished++;
+    }
+}
+
+static void* thread_main(void* arg) {
+    thread_t* thread = (thread_t*)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    thread->epoll_fd = epoll_create1(0);
+    if (thread->epoll_fd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < thread->num_conns; i++) {
+        conn_t* conn = &thread->conns[i];
+        conn->thread = thread;
+        conn->fd = -1;
+        conn->in_buf = malloc(READ_BUFFER_SIZE);
+        if (!conn->in_buf) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        conn_open(conn);
+    }
+
+    uint64_t now;
+    while ((now = now_ns()) < thread->deadline) {
+        uint64_t wake = thread->deadline;
+        if (target_rate > 0) {
+            issue_scheduled(thread, now);
+            if (thread->next_send < wake) {
+                wake = thread->next_send;
+            }
+        }
+        // nanosecond timeout, so the send schedule isn't rounded to milliseconds
+        uint64_t wait = wake > now ? wake - now : 0;
+        if (wait > 100000000) {
+            wait = 100000000;
+        }
+        struct timespec timeout = { .tv_sec = 0, .tv_nsec = (long)wait };
+        int n = epoll_pwait2(thread->epoll_fd, events, MAX_EVENTS, &timeout, NULL);
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_pwait2");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            conn_handle((conn_t*)events[i].data.ptr, events[i].events);
+        }
+    }
+
+    if (target_rate > 0) {
+        record_unfinished(thread);
+    }
+
+    for (int i = 0; i < thread->num_conns; i++) {
+        conn_close(&thread->conns[i]);
+        free(thread->conns[i].in_buf);
+    }
+    close(thread->epoll_fd);
+    return NULL;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -c, --connections N  open connections, spread over the threads (default 50)\n"
+            "  -t, --threads N      client threads, each with its own epoll loop (default 2)\n"
+            "  -d, --duration SEC   test length (default 10)\n"
+            "  -p, --pipeline N     requests in flight per connection (default 1, max %d)\n"
+            "  -C, --close          new connection for every request instead of keep-alive\n"
+            "  -R, --rate N         open loop: N requests/s in total on a fixed schedule,\n"
+            "                       latency measured from when each request was due\n"
+            "  -S, --sweep TO:STEP  open loop at -R, then -R + STEP, ... up to TO requests/s,\n"
+            "                       one -d long run per rate, to find the latency knee\n"
+            "  -H, --host ADDR      server address (default 127.0.0.1)\n"
+            "  -P, --port PORT      server port (default 8080)\n"
+            "  -u, --path PATH      request target (default /)\n"
+            "  -h, --help           show this help\n",
+            prog, MAX_PIPELINE);
+}
+
+static int parse_positive(const char* arg, const char* what) {
+    char* end;
+    long value = strtol(arg, &end, 10);
+    if (*end != '\0' || value <= 0 || value > 1000000) {
+        fprintf(stderr, "invalid %s: %s\n", what, arg);
+        exit(EXIT_FAILURE);
+    }
+    return (int)value;
+}
+
+static void parse_args(int argc, char* argv[]) {
+    static const struct option long_opts[] = {
+        {"connections", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 't'},
+        {"duration", required_argument, NULL, 'd'},
+        {"pipeline", required_argument, NULL, 'p'},
+        {"close", no_argument, NULL, 'C'},
+        {"rate", required_argument, NULL, 'R'},
+        {"sweep", required_argument, NULL, 'S'},
+        {"host", required_argument, NULL, 'H'},
+        {"port", required_argument, NULL, 'P'},
+        {"path", required_argument, NULL, 'u'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:t:d:p:CR:S:H:P:u:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            num_connections = parse_positive(optarg, "connection count");
+            break;
+        case 't':
+            num_threads = parse_positive(optarg, "thread count");
+            break;
+        case 'd':
+            duration_sec = parse_positive(optarg, "duration");
+            break;
+        case 'p':
+            pipeline_depth = parse_positive(optarg, "pipeline depth");
+            if (pipeline_depth > MAX_PIPELINE) {
+                fprintf(stderr, "pipeline depth is limited to %d\n", MAX_PIPELINE);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'C':
+            keep_alive = false;
+            break;
+        case 'R':
+            target_rate = parse_positive(optarg, "rate");
+            break;
+        case 'S':
+            if (sscanf(optarg, "%lf:%lf", &sweep_to, &sweep_step) != 2 || sweep_step <= 0) {
+                fprintf(stderr, "invalid sweep: %s (expected TO:STEP)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'H':
+            host = optarg;
+            break;
+        case 'P':
+            port = parse_positive(optarg, "port");
+            break;
+        case 'u':
+            path = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!keep_alive) {
+        pipeline_depth = 1;
+    }
+    if (sweep_to > 0 && target_rate == 0) {
+        fprintf(stderr, "--sweep needs a starting --rate\n");
+        exit(EXIT_FAILURE);
+    }
+    // open loop pipelines as deep as it has to to keep to the schedule
+    max_inflight = target_rate > 0 && keep_alive ? MAX_PIPELINE : pipeline_depth;
+    if (num_threads > num_connections) {
+        num_threads = num_connections;
+    }
+}
+
+static void build_requests(void) {
+    char request[1024];
+    int n = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s:%d\r\n%s\r\n",
+                     path, host, port, keep_alive ? "" : "Connection: close\r\n");
+    if (n < 0 || (size_t)n >= sizeof(request)) {
+        fprintf(stderr, "request path too long\n");
+        exit(EXIT_FAILURE);
+    }
+    request_len = n;
+
+    pipeline_buf = malloc(request_len * max_inflight);
+    if (!pipeline_buf) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < max_inflight; i++) {
+        memcpy(pipeline_buf + i * request_len, request, request_len);
+    }
+}
+
+// one run of duration_sec at the given total rate (0 for closed loop)
+static void run(double rate, result_t* result) {
+    thread_t* threads = calloc(num_threads, sizeof(thread_t));
+    conn_t* conns = calloc(num_connections, sizeof(conn_t));
+    if (!threads || !conns) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(result, 0, sizeof(*result));
+
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)duration_sec * 1000000000ULL;
+    int assigned = 0;
+    for (int i = 0; i < num_threads; i++) {
+        threads[i].conns = conns + assigned;
+        threads[i].num_conns = num_connections / num_threads + (i < num_connections % num_threads);
+        threads[i].deadline = deadline;
+        if (rate > 0) {
+            threads[i].interval = (uint64_t)(1e9 * num_threads / rate);
+            // stagger the threads so their schedules interleave
+            threads[i].next_send = start + threads[i].interval * i / num_threads;
+        }
+        assigned += threads[i].num_conns;
+        if (pthread_create(&threads[i].handle, NULL, thread_main, &threads[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    stats_t* total = &result->stats;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].handle, NULL);
+        hist_merge(&result->latency, &threads[i].latency);
+        hist_merge(&result->service, &threads[i].service);
+        total->requests += threads[i].stats.requests;
+        total->bytes_read += threads[i].stats.bytes_read;
+        total->connect_errors += threads[i].stats.connect_errors;
+        total->read_errors += threads[i].stats.read_errors;
+        total->write_errors += threads[i].stats.write_errors;
+        total->status_errors += threads[i].stats.status_errors;
+        total->unfinished += threads[i].stats.unfinished;
+        total->abandoned += threads[i].stats.abandoned;
+    }
+    result->elapsed = (now_ns() - start) / 1e9;
+
+    free(conns);
+    free(threads);
+}
+
+static const double percentiles[] = { 50, 90, 99, 99.9 };
+#define NUM_PERCENTILES (sizeof(percentiles) / sizeof(percentiles[0]))
+
+static void print_latency(const char* label, const histogram_t* h) {
+    char value[32];
+    printf("  %-9s", label);
+    for (size_t i = 0; i < NUM_PERCENTILES; i++) {
+        format_duration(value, sizeof(value), hist_percentile(h, percentiles[i]));
+        printf(" p%g %s", percentiles[i], value);
+    }
+    format_duration(value, sizeof(value), h->max);
+    printf("  max %s\n", value);
+}
+
+static void print_result(const result_t* result) {
+    const stats_t* total = &result->stats;
+    printf("  requests  %llu in %.2fs, %.1f/s, %.2f MB/s read\n",
+           (unsigned long long)total->requests, result->elapsed, total->requests / result->elapsed,
+           total->bytes_read / result->elapsed / 1e6);
+    print_latency("latency", &result->latency);
+    if (target_rate > 0) {
+        // without the correction: what a closed-loop client would have reported
+        print_latency("service", &result->service);
+        printf("  unfinished %llu (included in latency with their wait so far)\n",
+               (unsigned long long)total->unfinished);
+    }
+    printf("  errors    connect %llu, read %llu, write %llu, non-2xx %llu, abandoned %llu\n",
+           (unsigned long long)total->connect_errors, (unsigned long long)total->read_errors,
+           (unsigned long long)total->write_errors, (unsigned long long)total->status_errors,
+           (unsigned long long)total->abandoned);
+}
+
+// run every rate of the sweep and report where latency turns: the first rate
+// the server can't keep up with, or whose p99 is several times the p99 at the
+// lowest rate
+static void sweep(result_t* result) {
+    double baseline_p99 = 0;
+    double last_good = 0;
+    double knee = 0;
+    char value[32];
+
+    printf("  %10s %12s", "rate", "achieved");
+    for (size_t i = 0; i < NUM_PERCENTILES; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "p%g", percentiles[i]);
+        printf(" %9s", name);
+    }
+    printf(" %9s %8s\n", "max", "errors");
+
+    for (double rate = target_rate; rate <= sweep_to + 1e-9; rate += sweep_step) {
+        run(rate, result);
+        const stats_t* total = &result->stats;
+        double achieved = total->requests / result->elapsed;
+        uint64_t errors = total->connect_errors + total->read_errors + total->write_errors +
+                          total->status_errors + total->abandoned;
+
+        printf("  %10.0f %12.1f", rate, achieved);
+        for (size_t i = 0; i < NUM_PERCENTILES; i++) {
+            format_duration(value, sizeof(value), hist_percentile(&result->latency, percentiles[i]));
+            printf(" %9s", value);
+        }
+        format_duration(value, sizeof(value), result->latency.max);
+        printf(" %9s %8llu\n", value, (unsigned long long)errors);
+        fflush(stdout);
+
+        double p99 = hist_percentile(&result->latency, 99);
+        if (baseline_p99 == 0) {
+            baseline_p99 = p99;
+        }
+        if (knee == 0 && (achieved < 0.95 * rate || p99 > 5 * baseline_p99)) {
+            knee = rate;
+        }
+        if (knee == 0) {
+            last_good = rate;
+        }
+    }
+
+    if (knee == 0) {
+        printf("  no knee up to %.0f requests/s\n", sweep_to);
+    } else if (last_good == 0) {
+        printf("  already past the knee at %.0f requests/s\n", knee);
+    } else {
+        printf("  knee between %.0f and %.0f requests/s\n", last_good, knee);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    parse_args(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid address: %s\n", host);
+        return 1;
+    }
+    build_requests();
+
+    printf("%s:%d%s for %ds: %d threads, %d connections, %s, ", host, port, path, duration_sec,
+           num_threads, num_connections, keep_alive ? "keep-alive" : "connection per request");
+    if (target_rate > 0) {
+        printf(sweep_to > 0 ? "open loop at %.0f to %.0f requests/s\n" : "open loop at %.0f requests/s\n",
+               target_rate, sweep_to);
+    } else {
+        printf("pipeline depth %d\n", pipeline_depth);
+    }
+
+    result_t* result = malloc(sizeof(result_t));
+    if (!result) {
+        perror("malloc");
+        return 1;
+    }
+    if (sweep_to > 0) {
+        sweep(result);
+    } else {
+        run(target_rate, result);
+        print_result(result);
+    }
+
+    free(result);
+    free(pipeline_buf);
+    return 0;
+}
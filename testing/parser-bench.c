@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../http_parser.h"
+
+#define ITERATIONS 1000000
+#define MAX_HEAD_SIZE (64 * 1024)
+
+static const char typical_request[] =
+    "GET /wp-content/uploads/2010/03/hello-kitty-darth-vader-pink.jpg?size=large HTTP/1.1\r\n"
+    "Host: www.kittyhell.com\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; U; Intel Mac OS X 10_6_3; ja-JP-mac; rv:1.9.2.3) "
+    "Gecko/20100401 Firefox/3.6.3 Pathtraq/0.9\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: ja,en-us;q=0.7,en;q=0.3\r\n"
+    "Accept-Encoding: gzip,deflate\r\n"
+    "Accept-Charset: Shift_JIS,utf-8;q=0.7,*;q=0.7\r\n"
+    "Keep-Alive: 115\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static char* build_heavy_request(size_t* len) {
+    size_t size = 8192;
+    char* buf = malloc(size);
+    size_t n = snprintf(buf, size,
+                        "POST /api/v2/ingest/events?tenant=acme&batch=1 HTTP/1.1\r\n"
+                        "Host: ingest.example.com\r\n"
+                        "Content-Type: application/json\r\n"
+                        "Content-Length: 0\r\n");
+
+    // cookies and tracing headers dominate real-world heads
+    n += snprintf(buf + n, size - n, "Cookie: ");
+    for (int i = 0; i < 24; i++) {
+        n += snprintf(buf + n, size - n, "%ssession_%02d=%040d", i ? "; " : "", i, i * 7919);
+    }
+    n += snprintf(buf + n, size - n, "\r\n");
+    for (int i = 0; i < 20; i++) {
+        n += snprintf(buf + n, size - n, "X-Trace-Span-%02d: 00-%032x-%016x-01\r\n", i, i * 31337, i);
+    }
+    n += snprintf(buf + n, size - n, "\r\n");
+    *len = n;
+    return buf;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// feeding the request in two pieces at every split point must give the same
+// result as parsing it whole
+static int verify_splits(const char* name, const char* request, size_t len) {
+    http_parser_t parser;
+    http_request_t whole, split;
+
+    http_parser_init(&parser, MAX_HEAD_SIZE, HTTP_MAX_HEADERS);
+    if (http_parse_request(&parser, request, len, &whole) != HTTP_PARSE_DONE) {
+        printf("%s: failed to parse\n", name);
+        return 0;
+    }
+
+    for (size_t cut = 0; cut < len; cut++) {
+        http_parser_init(&parser, MAX_HEAD_SIZE, HTTP_MAX_HEADERS);
+        if (http_parse_request(&parser, request, cut, &split) != HTTP_PARSE_INCOMPLETE ||
+            http_parse_request(&parser, request, len, &split) != HTTP_PARSE_DONE ||
+            split.header_len != whole.header_len || split.num_headers != whole.num_headers ||
+            split.path.len != whole.path.len || split.query.len != whole.query.len ||
+            memcmp(&split.headers[split.num_headers - 1], &whole.headers[whole.num_headers - 1],
+                   sizeof(http_header_t)) != 0) {
+            printf("%s: mismatch when split at byte %zu\n", name, cut);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void bench(const char* name, const char* request, size_t len) {
+    http_parser_t parser;
+    http_request_t req;
+    size_t headers = 0;
+
+    http_parser_init(&parser, MAX_HEAD_SIZE, HTTP_MAX_HEADERS);
+
+    double start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        if (http_parse_request(&parser, request, len, &req) != HTTP_PARSE_DONE) {
+            printf("%s: parse failed\n", name);
+            exit(1);
+        }
+        headers += req.num_headers;
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%-7s %-14s %5zu bytes %3zu headers  %8.1f ns/request  %7.2f GB/s\n",
+           http_simd_name(http_parser_simd_level()), name, len, headers / ITERATIONS, elapsed / ITERATIONS,
+           (double)len * ITERATIONS / elapsed);
+}
+
+int main(void) {
+    size_t heavy_len;
+    char* heavy = build_heavy_request(&heavy_len);
+    size_t typical_len = sizeof(typical_request) - 1;
+
+    // every delimiter scanner the CPU supports, slowest first
+    for (int level = HTTP_SIMD_SCALAR; level <= HTTP_SIMD_AVX2; level++) {
+        if (!http_parser_set_simd_level(level)) {
+            continue;
+        }
+        if (!verify_splits("typical", typical_request, typical_len) ||
+            !verify_splits("header-heavy", heavy, heavy_len)) {
+            free(heavy);
+            return 1;
+        }
+
+        bench("typical", typical_request, typical_len);
+        bench("header-heavy", heavy, heavy_len);
+    }
+
+    free(heavy);
+    return 0;
+}
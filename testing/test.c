@@ -1,3 +1,5 @@
+#define _GNU_SOURCE  // strptime, timegm
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +9,11 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+
+#include "../timer_wheel.h"
 
 #define SERVER_PORT 8080
 #define NUM_PARALLEL_CLIENTS 10
@@ -14,10 +21,14 @@
 #define BUFFER_SIZE 4096
 #define RESPONSE_TIMEOUT_SEC 2
 
+// how the body of GET / ends: the hello page, or testing/www/index.html
+// when the server was started with --root testing/www
+static const char* body_end = "!\n";
+static int serving_files = 0;
+
 typedef struct {
     int successful_requests;
     int failed_requests;
-    double total_time;
 } test_stats_t;
 
 static ssize_t read_response(int sockfd, char* buffer, size_t buffer_size) {
@@ -95,6 +106,702 @@ static int make_request(const char* message, int print_response) {
     return bytes_read > 0;
 }
 
+static int connect_to_server(void) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in server_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(SERVER_PORT),
+        .sin_addr.s_addr = inet_addr("127.0.0.1")
+    };
+
+    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static int count_occurrences(const char* haystack, const char* needle) {
+    int count = 0;
+    for (const char* p = strstr(haystack, needle); p; p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+// read until `expected` complete responses (status line + body) have arrived
+static int read_responses(int sockfd, char* buffer, size_t buffer_size, int expected) {
+    size_t total_read = 0;
+    struct timeval timeout = { .tv_sec = RESPONSE_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    buffer[0] = '\0';
+    while (total_read < buffer_size - 1 && count_occurrences(buffer, body_end) < expected) {
+        ssize_t bytes = recv(sockfd, buffer + total_read, buffer_size - total_read - 1, 0);
+        if (bytes <= 0) break;
+        total_read += bytes;
+        buffer[total_read] = '\0';
+    }
+    return count_occurrences(buffer, "HTTP/1.1 200 OK");
+}
+
+// several sequential requests over one connection
+static int keep_alive_test(int num_requests) {
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return 0;
+
+    const char* request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char buffer[BUFFER_SIZE];
+    int ok = 1;
+
+    for (int i = 0; i < num_requests && ok; i++) {
+        if (send(sockfd, request, strlen(request), 0) < 0) {
+            perror("send");
+            ok = 0;
+            break;
+        }
+        ok = read_responses(sockfd, buffer, sizeof(buffer), 1) == 1;
+    }
+    close(sockfd);
+    return ok;
+}
+
+// several requests in a single send, answered in order on one connection
+static int pipelining_test(int depth) {
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return 0;
+
+    char request[BUFFER_SIZE];
+    size_t len = 0;
+    for (int i = 0; i < depth; i++) {
+        len += snprintf(request + len, sizeof(request) - len,
+                        "GET /?%d HTTP/1.1\r\nHost: localhost\r\n%s\r\n",
+                        i, i == depth - 1 ? "Connection: close\r\n" : "");
+    }
+
+    if (send(sockfd, request, len, 0) < 0) {
+        perror("send");
+        close(sockfd);
+        return 0;
+    }
+
+    char buffer[BUFFER_SIZE * 4];
+    int responses = read_responses(sockfd, buffer, sizeof(buffer), depth);
+    close(sockfd);
+    return responses == depth && strstr(buffer, "Connection: close\r\n") != NULL;
+}
+
+// one request delivered in several segments, with a large header block
+static int split_request_test(size_t header_bytes) {
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return 0;
+
+    size_t size = header_bytes + 256;
+    char* request = malloc(size);
+    size_t len = snprintf(request, size, "GET / HTTP/1.1\r\nHost: localhost\r\nX-Padding: ");
+    memset(request + len, 'x', header_bytes);
+    len += header_bytes;
+    len += snprintf(request + len, size - len, "\r\nConnection: close\r\n\r\n");
+
+    // dribble the request out in uneven pieces
+    size_t sent = 0;
+    size_t piece = 7;
+    while (sent < len) {
+        size_t n = len - sent < piece ? len - sent : piece;
+        if (send(sockfd, request + sent, n, 0) < 0) {
+            perror("send");
+            break;
+        }
+        sent += n;
+        piece = piece * 3 + 1;
+        usleep(1000);
+    }
+    free(request);
+
+    char buffer[BUFFER_SIZE];
+    int responses = read_responses(sockfd, buffer, sizeof(buffer), 1);
+    close(sockfd);
+    return responses == 1;
+}
+
+// pipeline far more responses than the server will buffer, reading them
+// back slowly; every request must still be answered, in full
+static int backpressure_test(int num_requests) {
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return 0;
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+
+    const char* request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    size_t request_len = strlen(request);
+    size_t total = request_len * num_requests;
+    size_t sent = 0;
+    int responses = 0;
+    size_t matched = 0;
+    size_t end_len = strlen(body_end);
+    char buffer[BUFFER_SIZE];
+
+    while (responses < num_requests) {
+        struct pollfd pfd = { .fd = sockfd, .events = POLLIN | (sent < total ? POLLOUT : 0) };
+        if (poll(&pfd, 1, RESPONSE_TIMEOUT_SEC * 1000) <= 0) break;
+
+        if ((pfd.revents & POLLOUT) && sent < total) {
+            size_t off = sent % request_len;
+            ssize_t n = send(sockfd, request + off, request_len - off, 0);
+            if (n > 0) sent += n;
+        }
+        if (pfd.revents & POLLIN) {
+            ssize_t n = recv(sockfd, buffer, sizeof(buffer), 0);
+            if (n <= 0) break;
+            // count body endings, which may straddle reads
+            for (ssize_t i = 0; i < n; i++) {
+                if (buffer[i] == body_end[matched]) {
+                    matched++;
+                } else {
+                    matched = buffer[i] == body_end[0];
+                }
+                if (matched == end_len) {
+                    responses++;
+                    matched = 0;
+                }
+            }
+            usleep(50);
+        }
+    }
+    close(sockfd);
+    return responses == num_requests;
+}
+
+// the metrics endpoint answers in Prometheus text format and has counted
+// the requests of the earlier tests
+static int metrics_test(void) {
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return 0;
+
+    const char* request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    if (send(sockfd, request, strlen(request), 0) < 0) {
+        perror("send");
+        close(sockfd);
+        return 0;
+    }
+
+    // Connection: close, so the whole response is everything up to EOF
+    static char buffer[64 * 1024];
+    size_t total_read = 0;
+    struct timeval timeout = { .tv_sec = RESPONSE_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (total_read < sizeof(buffer) - 1) {
+        ssize_t bytes = recv(sockfd, buffer + total_read, sizeof(buffer) - total_read - 1, 0);
+        if (bytes <= 0) break;
+        total_read += bytes;
+    }
+    buffer[total_read] = '\0';
+    close(sockfd);
+
+    const char* requests = strstr(buffer, "\nhttp_requests_total{worker=\"0\"} ");
+    return strstr(buffer, "HTTP/1.1 200 OK") != NULL &&
+           strstr(buffer, "# TYPE http_requests_total counter") != NULL &&
+           strstr(buffer, "http_request_duration_seconds_bucket{worker=\"0\",le=\"+Inf\"}") != NULL &&
+           strstr(buffer, "\nlog_dropped_total ") != NULL &&
+           requests != NULL && strtoull(strchr(requests, '}') + 1, NULL, 10) > 0;
+}
+
+// every response carries an RFC 7231 Date close to the local clock
+static int date_header_test(void) {
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return 0;
+
+    const char* request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    if (send(sockfd, request, strlen(request), 0) < 0) {
+        perror("send");
+        close(sockfd);
+        return 0;
+    }
+
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes = read_response(sockfd, buffer, sizeof(buffer));
+    close(sockfd);
+    if (bytes <= 0) return 0;
+
+    const char* date = strstr(buffer, "\r\nDate: ");
+    if (!date) return 0;
+    struct tm tm = {0};
+    const char* end = strptime(date + 8, "%a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+    if (!end) return 0;
+    time_t sent = timegm(&tm);
+    return end[-1] == '\n' && sent >= time(NULL) - 5 && sent <= time(NULL) + 5;
+}
+
+// send a Connection: close request and read the response up to EOF
+static ssize_t fetch(const char* request, char* buffer, size_t buffer_size) {
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return -1;
+
+    if (send(sockfd, request, strlen(request), 0) < 0) {
+        perror("send");
+        close(sockfd);
+        return -1;
+    }
+
+    size_t total_read = 0;
+    struct timeval timeout = { .tv_sec = RESPONSE_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (total_read < buffer_size - 1) {
+        ssize_t bytes = recv(sockfd, buffer + total_read, buffer_size - total_read - 1, 0);
+        if (bytes <= 0) break;
+        total_read += bytes;
+    }
+    buffer[total_read] = '\0';
+    close(sockfd);
+    return total_read;
+}
+
+// a server without --root answers every path with the hello page
+static void detect_document_root(void) {
+    char buffer[BUFFER_SIZE];
+    if (fetch("GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+              buffer, sizeof(buffer)) > 0 && !strstr(buffer, "Hello from worker")) {
+        serving_files = 1;
+        body_end = "</html>\n";
+    }
+}
+
+// needs the server started with --root testing/www; -1 when it runs
+// without a document root
+static int static_file_test(void) {
+    if (!serving_files) return -1;
+
+    char buffer[BUFFER_SIZE];
+    if (fetch("GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+              buffer, sizeof(buffer)) <= 0) {
+        return 0;
+    }
+
+    int passed = strstr(buffer, "HTTP/1.1 200 OK\r\n") != NULL &&
+                 strstr(buffer, "\r\nContent-Type: text/html") != NULL &&
+                 strstr(buffer, "\r\nContent-Length: 127\r\n") != NULL &&
+                 strstr(buffer, "\r\nLast-Modified: ") != NULL &&
+                 strstr(buffer, "\r\nETag: \"") != NULL &&
+                 strstr(buffer, "<title>c-http</title>") != NULL;
+
+    // missing files and attempts to leave the root are both 404
+    const char* not_found[] = {
+        "GET /missing.txt HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+        "GET /../Makefile HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+        "GET /%2e%2e/Makefile HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+    };
+    for (size_t i = 0; i < sizeof(not_found) / sizeof(not_found[0]); i++) {
+        if (fetch(not_found[i], buffer, sizeof(buffer)) <= 0 ||
+            !strstr(buffer, "HTTP/1.1 404 Not Found\r\n")) {
+            passed = 0;
+        }
+    }
+    return passed;
+}
+
+// a request carrying the validators of the current file gets 304 and no
+// body; one with a stale tag gets the file
+static int conditional_test(void) {
+    if (!serving_files) return -1;
+
+    char buffer[BUFFER_SIZE];
+    if (fetch("GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+              buffer, sizeof(buffer)) <= 0) {
+        return 0;
+    }
+    char etag[64], modified[64];
+    const char* p = strstr(buffer, "\r\nETag: ");
+    const char* q = strstr(buffer, "\r\nLast-Modified: ");
+    if (!p || !q ||
+        sscanf(p, "\r\nETag: %63[^\r]", etag) != 1 ||
+        sscanf(q, "\r\nLast-Modified: %63[^\r]", modified) != 1) {
+        return 0;
+    }
+
+    char request[256];
+    snprintf(request, sizeof(request), "GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+             "If-None-Match: \"stale\", %s\r\nConnection: close\r\n\r\n", etag);
+    if (fetch(request, buffer, sizeof(buffer)) <= 0 ||
+        !strstr(buffer, "HTTP/1.1 304 Not Modified\r\n") || strstr(buffer, "<title>") ||
+        !strstr(buffer, etag)) {
+        return 0;
+    }
+    snprintf(request, sizeof(request), "GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+             "If-Modified-Since: %s\r\nConnection: close\r\n\r\n", modified);
+    if (fetch(request, buffer, sizeof(buffer)) <= 0 ||
+        !strstr(buffer, "HTTP/1.1 304 Not Modified\r\n")) {
+        return 0;
+    }
+    return fetch("GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+                 "If-None-Match: \"stale\"\r\nConnection: close\r\n\r\n",
+                 buffer, sizeof(buffer)) > 0 &&
+           strstr(buffer, "HTTP/1.1 200 OK\r\n") && strstr(buffer, "<title>c-http</title>");
+}
+
+// single ranges, multipart/byteranges and a range past the end of the file
+static int range_test(void) {
+    if (!serving_files) return -1;
+
+    char buffer[BUFFER_SIZE];
+    if (fetch("GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+              "Range: bytes=0-14\r\nConnection: close\r\n\r\n", buffer, sizeof(buffer)) <= 0 ||
+        !strstr(buffer, "HTTP/1.1 206 Partial Content\r\n") ||
+        !strstr(buffer, "\r\nContent-Range: bytes 0-14/127\r\n") ||
+        !strstr(buffer, "\r\nContent-Length: 15\r\n") ||
+        strcmp(strstr(buffer, "\r\n\r\n") + 4, "<!DOCTYPE html>") != 0) {
+        return 0;
+    }
+    if (fetch("GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+              "Range: bytes=-8\r\nConnection: close\r\n\r\n", buffer, sizeof(buffer)) <= 0 ||
+        !strstr(buffer, "\r\nContent-Range: bytes 119-126/127\r\n") ||
+        strcmp(strstr(buffer, "\r\n\r\n") + 4, "</html>\n") != 0) {
+        return 0;
+    }
+    if (fetch("GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+              "Range: bytes=0-4, 119-\r\nConnection: close\r\n\r\n", buffer, sizeof(buffer)) <= 0 ||
+        !strstr(buffer, "\r\nContent-Type: multipart/byteranges; boundary=") ||
+        !strstr(buffer, "\r\nContent-Range: bytes 0-4/127\r\n\r\n<!DOC\r\n--") ||
+        !strstr(buffer, "\r\nContent-Range: bytes 119-126/127\r\n\r\n</html>\n\r\n--")) {
+        return 0;
+    }
+    return fetch("GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+                 "Range: bytes=500-\r\nConnection: close\r\n\r\n", buffer, sizeof(buffer)) > 0 &&
+           strstr(buffer, "HTTP/1.1 416 Range Not Satisfiable\r\n") &&
+           strstr(buffer, "\r\nContent-Range: bytes */127\r\n");
+}
+
+// app.js has a gzip sidecar: clients that take gzip get it, with its own
+// ETag; the rest get the file. Both vary on Accept-Encoding.
+static int encoding_test(void) {
+    if (!serving_files) return -1;
+
+    char buffer[BUFFER_SIZE];
+    if (fetch("GET /app.js HTTP/1.1\r\nHost: localhost\r\n"
+              "Accept-Encoding: br;q=0.5, gzip, deflate\r\nConnection: close\r\n\r\n",
+              buffer, sizeof(buffer)) <= 0) {
+        return 0;
+    }
+    const char* body = strstr(buffer, "\r\n\r\n");
+    char gzip_etag[64];
+    const char* p = strstr(buffer, "\r\nETag: ");
+    if (!body || !p || sscanf(p, "\r\nETag: %63[^\r]", gzip_etag) != 1 ||
+        !strstr(buffer, "HTTP/1.1 200 OK\r\n") ||
+        !strstr(buffer, "\r\nContent-Type: text/javascript") ||
+        !strstr(buffer, "\r\nContent-Encoding: gzip\r\n") ||
+        !strstr(buffer, "\r\nVary: Accept-Encoding\r\n") ||
+        !strstr(buffer, "\r\nContent-Length: 391\r\n") ||
+        memcmp(body + 4, "\x1f\x8b", 2) != 0) {
+        return 0;
+    }
+
+    if (fetch("GET /app.js HTTP/1.1\r\nHost: localhost\r\n"
+              "Accept-Encoding: gzip;q=0, *\r\nConnection: close\r\n\r\n",
+              buffer, sizeof(buffer)) <= 0 ||
+        strstr(buffer, "\r\nContent-Encoding: ") ||
+        !strstr(buffer, "\r\nVary: Accept-Encoding\r\n") ||
+        !strstr(buffer, "\r\nContent-Length: 724\r\n") || strstr(buffer, gzip_etag)) {
+        return 0;
+    }
+
+    // the sidecar's validators answer for it
+    char request[256];
+    snprintf(request, sizeof(request), "GET /app.js HTTP/1.1\r\nHost: localhost\r\n"
+             "Accept-Encoding: gzip\r\nIf-None-Match: %s\r\nConnection: close\r\n\r\n",
+             gzip_etag);
+    return fetch(request, buffer, sizeof(buffer)) > 0 &&
+           strstr(buffer, "HTTP/1.1 304 Not Modified\r\n") &&
+           !strstr(buffer, "\r\nContent-Encoding: ") &&
+           strstr(buffer, "\r\nVary: Accept-Encoding\r\n");
+}
+
+// bodies compressed on the fly: /metrics always, a stylesheet with --root,
+// whose repeats come from the worker's cache byte for byte
+static int compression_test(void) {
+    static char buffer[64 * 1024];
+    ssize_t n = fetch("GET /metrics HTTP/1.1\r\nHost: localhost\r\n"
+                      "Accept-Encoding: gzip\r\nConnection: close\r\n\r\n",
+                      buffer, sizeof(buffer));
+    const char* body = n > 0 ? strstr(buffer, "\r\n\r\n") : NULL;
+    const char* length = n > 0 ? strstr(buffer, "\r\nContent-Length: ") : NULL;
+    if (!body || !length || !strstr(buffer, "\r\nContent-Encoding: gzip\r\n") ||
+        !strstr(buffer, "\r\nVary: Accept-Encoding\r\n") ||
+        strtol(length + 18, NULL, 10) != buffer + n - (body + 4) ||
+        memcmp(body + 4, "\x1f\x8b", 2) != 0) {
+        return 0;
+    }
+    if (!serving_files) return 1;
+
+    const char* request = "GET /style.css HTTP/1.1\r\nHost: localhost\r\n"
+                          "Accept-Encoding: deflate;q=0.5, gzip\r\nConnection: close\r\n\r\n";
+    char first[BUFFER_SIZE], second[BUFFER_SIZE];
+    ssize_t first_len = fetch(request, first, sizeof(first));
+    ssize_t second_len = fetch(request, second, sizeof(second));
+    const char* first_body = first_len > 0 ? strstr(first, "\r\n\r\n") : NULL;
+    const char* second_body = second_len > 0 ? strstr(second, "\r\n\r\n") : NULL;
+    if (!first_body || !second_body ||
+        first + first_len - first_body != second + second_len - second_body ||
+        memcmp(first_body, second_body, first + first_len - first_body) != 0 ||
+        !strstr(first, "\r\nContent-Encoding: gzip\r\n") ||
+        !strstr(first, "\r\nVary: Accept-Encoding\r\n") ||
+        !strstr(first, "\r\nETag: W/\"") ||
+        first + first_len - (first_body + 4) >= 1238 ||
+        memcmp(first_body + 4, "\x1f\x8b", 2) != 0) {
+        return 0;
+    }
+
+    // without Accept-Encoding the file goes out as it is
+    return fetch("GET /style.css HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+                 first, sizeof(first)) > 0 &&
+           !strstr(first, "\r\nContent-Encoding: ") &&
+           strstr(first, "\r\nVary: Accept-Encoding\r\n") &&
+           strstr(first, "\r\nContent-Length: 1238\r\n");
+}
+
+// a repeated request for a small file is answered from the hot cache shared
+// by the workers, byte for byte the same as when it was read from disk
+static int hot_cache_test(void) {
+    if (!serving_files) return -1;
+
+    const char* request = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    char first[BUFFER_SIZE], second[BUFFER_SIZE];
+    if (fetch(request, first, sizeof(first)) <= 0 || fetch(request, second, sizeof(second)) <= 0) {
+        return 0;
+    }
+    const char* first_body = strstr(first, "\r\n\r\n");
+    const char* second_body = strstr(second, "\r\n\r\n");
+    const char* first_etag = strstr(first, "\r\nETag: ");
+    const char* second_etag = strstr(second, "\r\nETag: ");
+    if (!first_body || !second_body || !first_etag || !second_etag ||
+        strcmp(first_body, second_body) != 0 || strlen(first_body + 4) != 127 ||
+        strncmp(first_etag, second_etag, strcspn(first_etag + 2, "\r") + 2) != 0) {
+        return 0;
+    }
+
+    static char metrics[64 * 1024];
+    if (fetch("GET /metrics HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+              metrics, sizeof(metrics)) <= 0) {
+        return 0;
+    }
+    unsigned long long hits = 0;
+    for (const char* p = metrics; (p = strstr(p, "\nhttp_hot_cache_hits_total{")); p++) {
+        hits += strtoull(strchr(p, '}') + 1, NULL, 10);
+    }
+    return hits > 0;
+}
+
+// /stream generates its body as the client reads it: chunked, far larger
+// than the server buffers, and followed in order by a request pipelined
+// behind it. An HTTP/1.0 client gets the body up to the close instead.
+static int stream_test(void) {
+    static char buffer[1024 * 1024];
+    ssize_t n = fetch("GET /stream?lines=100000 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                      "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+                      buffer, sizeof(buffer));
+    char* p = n > 0 ? strstr(buffer, "\r\n\r\n") : NULL;
+    if (!p || strncmp(buffer, "HTTP/1.1 200 OK\r\n", 17) != 0 ||
+        !memmem(buffer, p - buffer, "\r\nTransfer-Encoding: chunked", 28) ||
+        memmem(buffer, p - buffer, "\r\nContent-Length: ", 18)) {
+        return 0;
+    }
+    p += 4;
+
+    // each chunk holds whole lines, counting up from 1
+    unsigned long line = 0;
+    char* end;
+    for (;;) {
+        unsigned long size = strtoul(p, &end, 16);
+        if (end == p || strncmp(end, "\r\n", 2) != 0) return 0;
+        p = end + 2;
+        if (size == 0) break;
+        if (p + size + 2 > buffer + n || strncmp(p + size, "\r\n", 2) != 0) return 0;
+        for (char* stop = p + size; p < stop; p = end + 1) {
+            if (strtoul(p, &end, 10) != ++line || *end != '\n') return 0;
+        }
+        p += 2;
+    }
+    if (line != 100000 || strncmp(p, "\r\nHTTP/1.1 200 OK\r\n", 19) != 0 ||
+        count_occurrences(p, body_end) != 1) {
+        return 0;
+    }
+
+    n = fetch("GET /stream?lines=5 HTTP/1.0\r\n\r\n", buffer, sizeof(buffer));
+    p = n > 0 ? strstr(buffer, "\r\n\r\n") : NULL;
+    return p && !strstr(buffer, "Transfer-Encoding") && strcmp(p + 4, "1\n2\n3\n4\n5\n") == 0;
+}
+
+// POST /checksum reads the body as it arrives: chunked framing with an
+// extension and a trailer is decoded and the request pipelined behind it
+// answered; a body over the limit is refused before the client sends it,
+// and an accepted one is asked for with 100 Continue
+static int body_test(void) {
+    char buffer[BUFFER_SIZE];
+    // CRC-32 of "The quick brown fox jumps over the lazy dog" is 414fa339
+    ssize_t n = fetch("POST /checksum HTTP/1.1\r\nHost: localhost\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n"
+                      "4\r\nThe \r\n10;part=2\r\nquick brown fox \r\n"
+                      "17\r\njumps over the lazy dog\r\n0\r\nX-Trailer: 1\r\n\r\n"
+                      "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+                      buffer, sizeof(buffer));
+    if (n <= 0 || !strstr(buffer, "\r\n\r\n43 414fa339\nHTTP/1.1 200 OK\r\n") ||
+        count_occurrences(buffer, body_end) != 1) {
+        return 0;
+    }
+
+    n = fetch("POST /checksum HTTP/1.1\r\nHost: localhost\r\nExpect: 100-continue\r\n"
+              "Content-Length: 1000000000\r\n\r\n", buffer, sizeof(buffer));
+    if (n <= 0 || strncmp(buffer, "HTTP/1.1 413 ", 13) != 0) {
+        return 0;
+    }
+
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return 0;
+    const char* head = "POST /checksum HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+                       "Expect: 100-continue\r\nContent-Length: 43\r\n\r\n";
+    const char* body = "The quick brown fox jumps over the lazy dog";
+    int ok = send(sockfd, head, strlen(head), 0) > 0 &&
+             read_response(sockfd, buffer, sizeof(buffer)) > 0 &&
+             strcmp(buffer, "HTTP/1.1 100 Continue\r\n\r\n") == 0 &&
+             send(sockfd, body, strlen(body), 0) > 0;
+    size_t len = 0;
+    ssize_t bytes;
+    while (ok && len < sizeof(buffer) - 1 &&
+           (bytes = recv(sockfd, buffer + len, sizeof(buffer) - len - 1, 0)) > 0) {
+        len += bytes;
+    }
+    buffer[len] = '\0';
+    close(sockfd);
+    return ok && strncmp(buffer, "HTTP/1.1 200 OK\r\n", 17) == 0 &&
+           strstr(buffer, "\r\n\r\n43 414fa339\n");
+}
+
+// framing that a later header contradicts is refused, whichever comes
+// first: Content-Length values that differ get 400, and Transfer-Encoding
+// lines that add up to more than a bare chunked get 501
+static int framing_test(void) {
+    static const char* const conflicts[] = {
+        "Content-Length: 0\r\nContent-Length: 5\r\n",
+        "Content-Length: 5\r\nContent-Length: 0\r\n",
+    };
+    char request[BUFFER_SIZE], buffer[BUFFER_SIZE];
+    for (size_t i = 0; i < sizeof(conflicts) / sizeof(conflicts[0]); i++) {
+        snprintf(request, sizeof(request), "POST /checksum HTTP/1.1\r\nHost: localhost\r\n"
+                 "Connection: close\r\n%s\r\nhello", conflicts[i]);
+        if (fetch(request, buffer, sizeof(buffer)) <= 0 ||
+            strncmp(buffer, "HTTP/1.1 400 ", 13) != 0) {
+            return 0;
+        }
+    }
+    return fetch("POST /checksum HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+                 "Transfer-Encoding: chunked\r\nTransfer-Encoding: gzip\r\n\r\n"
+                 "0\r\n\r\n", buffer, sizeof(buffer)) > 0 &&
+           strncmp(buffer, "HTTP/1.1 501 ", 13) == 0;
+}
+
+// PUT /upload/NAME stores the body under --upload-dir, the part that didn't
+// arrive with the head spliced from the socket to the file; a second PUT
+// replaces it, chunked. -1 when the server runs without an upload directory.
+static int upload_test(void) {
+    static char request[256 * 1024 + 256];
+    size_t body_len = 256 * 1024;
+    int head_len = snprintf(request, 256, "PUT /upload/server-test.bin HTTP/1.1\r\n"
+                            "Host: localhost\r\nConnection: close\r\n"
+                            "Content-Length: %zu\r\n\r\n", body_len);
+    memset(request + head_len, 'u', body_len);
+    request[head_len + body_len] = '\0';
+
+    char buffer[BUFFER_SIZE];
+    if (fetch(request, buffer, sizeof(buffer)) <= 0) return 0;
+    if (strstr(buffer, "Hello from worker") || strncmp(buffer, "HTTP/1.1 404 ", 13) == 0 ||
+        strncmp(buffer, "HTTP/1.1 405 ", 13) == 0) {
+        return -1;
+    }
+    if (strncmp(buffer, "HTTP/1.1 201 ", 13) != 0 && strncmp(buffer, "HTTP/1.1 200 ", 13) != 0) {
+        return 0;
+    }
+
+    static char metrics[64 * 1024];
+    if (fetch("GET /metrics HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+              metrics, sizeof(metrics)) <= 0) {
+        return 0;
+    }
+    unsigned long long spliced = 0;
+    for (const char* p = metrics; (p = strstr(p, "\nhttp_upload_bytes_spliced_total{")); p++) {
+        spliced += strtoull(strchr(p, '}') + 1, NULL, 10);
+    }
+    if (spliced == 0) return 0;
+
+    return fetch("PUT /upload/server-test.bin HTTP/1.1\r\nHost: localhost\r\n"
+                 "Connection: close\r\nTransfer-Encoding: chunked\r\n\r\n"
+                 "5\r\nhello\r\n0\r\n\r\n", buffer, sizeof(buffer)) > 0 &&
+           strncmp(buffer, "HTTP/1.1 200 OK\r\n", 17) == 0 &&
+           fetch("PUT /upload/.server-test HTTP/1.1\r\nHost: localhost\r\n"
+                 "Connection: close\r\nContent-Length: 1\r\n\r\nx", buffer, sizeof(buffer)) > 0 &&
+           strncmp(buffer, "HTTP/1.1 400 ", 13) == 0;
+}
+
+// a connection that never sends anything is closed by the server once the
+// keep-alive timeout (5s) passes
+static int idle_timeout_test(void) {
+    int sockfd = connect_to_server();
+    if (sockfd < 0) return 0;
+
+    struct timeval timeout = { .tv_sec = 8, .tv_usec = 0 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char buffer[16];
+    ssize_t bytes = recv(sockfd, buffer, sizeof(buffer), 0);
+    close(sockfd);
+    return bytes == 0;
+}
+
+// a timer its own callback re-arms for a time already reached, or past,
+// fires on the next tick rather than a whole revolution of the wheel later.
+// Runs on the wheel directly, without the server.
+typedef struct {
+    wheel_timer_t timer;            // first, so the callback can cast back
+    timer_wheel_t* wheel;
+    uint64_t rearm_ms;
+    int fired;
+} rearm_timer_t;
+
+static void rearm_expire(wheel_timer_t* timer) {
+    rearm_timer_t* rearm = (rearm_timer_t*)timer;
+    if (++rearm->fired < 3) {
+        timer_schedule(rearm->wheel, timer, rearm->rearm_ms);
+    }
+}
+
+static int timer_wheel_test(void) {
+    static timer_wheel_t wheel;
+    rearm_timer_t rearm = { .wheel = &wheel, .rearm_ms = 10 };
+    timer_wheel_init(&wheel, 0);
+    timer_schedule(&wheel, &rearm.timer, 10);
+
+    // re-armed for the tick being fired
+    timer_wheel_advance(&wheel, 10, rearm_expire);
+    if (rearm.fired != 1 || !timer_pending(&rearm.timer) ||
+        timer_wheel_timeout(&wheel, 10, 1000) != 10) {
+        return 0;
+    }
+    // re-armed for a tick already gone
+    rearm.rearm_ms = 0;
+    timer_wheel_advance(&wheel, 20, rearm_expire);
+    if (rearm.fired != 2 || !timer_pending(&rearm.timer)) {
+        return 0;
+    }
+    timer_wheel_advance(&wheel, 30, rearm_expire);
+    return rearm.fired == 3 && !timer_pending(&rearm.timer);
+}
+
+static void report(const char* test_name, int passed) {
+    printf("%s %s %s\n", passed ? "✓" : "✗", test_name, passed ? "passed" : "failed");
+}
+
 void* client_thread(void* arg) {
     test_stats_t* stats = (test_stats_t*)arg;
     const char* request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
@@ -122,6 +829,7 @@ int main() {
     printf("Starting server tests...\n");
     printf("Note: Server should be running on port %d\n\n", SERVER_PORT);
     sleep(1); // give server time to start if just launched
+    detect_document_root();
 
     // Test 1: Basic HTTP request
     const char* basic_request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
@@ -140,15 +848,115 @@ int main() {
     run_test("Large request test", large_request, 1);
     free(large_request);
 
-    // Test 4: Parallel client test
+    // Test 4: Keep-alive
+    printf("\nRunning keep-alive test...\n");
+    report("Keep-alive test", keep_alive_test(5));
+
+    // Test 5: Pipelining
+    printf("\nRunning pipelining test...\n");
+    report("Pipelining test", pipelining_test(10));
+
+    // Test 6: Request split across segments, larger than one read buffer
+    printf("\nRunning split request test...\n");
+    report("Split request test", split_request_test(3 * BUFFER_SIZE));
+
+    // Test 7: Output backpressure
+    printf("\nRunning backpressure test...\n");
+    report("Backpressure test", backpressure_test(100000));
+
+    // Test 8: Metrics endpoint
+    printf("\nRunning metrics test...\n");
+    report("Metrics test", metrics_test());
+
+    // Test 9: Date header
+    printf("\nRunning date header test...\n");
+    report("Date header test", date_header_test());
+
+    // Test 10: Static files
+    printf("\nRunning static file test...\n");
+    int static_result = static_file_test();
+    if (static_result < 0) {
+        printf("- Static file test skipped (start the server with --root testing/www)\n");
+    } else {
+        report("Static file test", static_result);
+    }
+
+    // Test 11: Hot cache
+    printf("\nRunning hot cache test...\n");
+    int hot_result = hot_cache_test();
+    if (hot_result < 0) {
+        printf("- Hot cache test skipped (start the server with --root testing/www)\n");
+    } else {
+        report("Hot cache test", hot_result);
+    }
+
+    // Test 12: Conditional requests
+    printf("\nRunning conditional request test...\n");
+    int conditional_result = conditional_test();
+    if (conditional_result < 0) {
+        printf("- Conditional request test skipped (start the server with --root testing/www)\n");
+    } else {
+        report("Conditional request test", conditional_result);
+    }
+
+    // Test 13: Range requests
+    printf("\nRunning range request test...\n");
+    int range_result = range_test();
+    if (range_result < 0) {
+        printf("- Range request test skipped (start the server with --root testing/www)\n");
+    } else {
+        report("Range request test", range_result);
+    }
+
+    // Test 14: Precompressed sidecars
+    printf("\nRunning content encoding test...\n");
+    int encoding_result = encoding_test();
+    if (encoding_result < 0) {
+        printf("- Content encoding test skipped (start the server with --root testing/www)\n");
+    } else {
+        report("Content encoding test", encoding_result);
+    }
+
+    // Test 15: Compression on the fly
+    printf("\nRunning compression test...\n");
+    report("Compression test", compression_test());
+
+    // Test 16: Streamed responses
+    printf("\nRunning streaming test...\n");
+    report("Streaming test", stream_test());
+
+    // Test 17: Request bodies
+    printf("\nRunning request body test...\n");
+    report("Request body test", body_test());
+
+    // Test 18: Conflicting framing headers
+    printf("\nRunning framing test...\n");
+    report("Framing test", framing_test());
+
+    // Test 19: Uploads
+    printf("\nRunning upload test...\n");
+    int upload_result = upload_test();
+    if (upload_result < 0) {
+        printf("- Upload test skipped (start the server with --upload-dir DIR)\n");
+    } else {
+        report("Upload test", upload_result);
+    }
+
+    // Test 20: Idle connections time out
+    printf("\nRunning idle timeout test...\n");
+    report("Idle timeout test", idle_timeout_test());
+
+    // Test 21: Timer wheel re-arming from a callback
+    printf("\nRunning timer wheel test...\n");
+    report("Timer wheel test", timer_wheel_test());
+
+    // Test 22: Parallel client test (correctness under concurrency; for
+    // throughput and latency use load-gen)
     printf("\nRunning parallel clients test (%d clients, %d requests each)...\n", 
            NUM_PARALLEL_CLIENTS, NUM_REQUESTS_PER_CLIENT);
 
     pthread_t threads[NUM_PARALLEL_CLIENTS];
     test_stats_t stats = {0};
-    struct timeval start, end;
-
-    gettimeofday(&start, NULL);
 
     for (int i = 0; i < NUM_PARALLEL_CLIENTS; i++) {
         if (pthread_create(&threads[i], NULL, client_thread, &stats) != 0) {
@@ -161,17 +969,9 @@ int main() {
         pthread_join(threads[i], NULL);
     }
 
-    gettimeofday(&end, NULL);
-    stats.total_time = (end.tv_sec - start.tv_sec) + 
-                      (end.tv_usec - start.tv_usec) / 1000000.0;
-
-    printf("\nParallel test results:\n");
-    printf("Total requests: %d\n", NUM_PARALLEL_CLIENTS * NUM_REQUESTS_PER_CLIENT);
-    printf("Successful requests: %d\n", stats.successful_requests);
-    printf("Failed requests: %d\n", stats.failed_requests);
-    printf("Total time: %.2f seconds\n", stats.total_time);
-    printf("Requests per second: %.2f\n", 
-           (stats.successful_requests + stats.failed_requests) / stats.total_time);
+    printf("Successful requests: %d, failed requests: %d\n",
+           stats.successful_requests, stats.failed_requests);
+    report("Parallel clients test", stats.failed_requests == 0);
 
     return 0;
 }
\ No newline at end of file
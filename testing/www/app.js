@@ -0,0 +1,24 @@
+// served as is, or as app.js.gz to clients that accept gzip
+const routes = [
+    { path: "/", title: "Home" },
+    { path: "/about", title: "About" },
+    { path: "/contact", title: "Contact" },
+    { path: "/docs", title: "Documentation" },
+    { path: "/blog", title: "Blog" },
+];
+
+function renderNav(current) {
+    return routes
+        .map((route) => {
+            const active = route.path === current ? ' class="active"' : "";
+            return `<a href="${route.path}"${active}>${route.title}</a>`;
+        })
+        .join("\n");
+}
+
+document.addEventListener("DOMContentLoaded", () => {
+    const nav = document.querySelector("nav");
+    if (nav) {
+        nav.innerHTML = renderNav(location.pathname);
+    }
+});
@@ -0,0 +1,173 @@
+#include "timer_wheel.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+void timer_wheel_init(timer_wheel_t* wheel, uint64_t now_ms) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now_ms / WHEEL_TICK_MS;
+}
+
+static void link_timer(timer_wheel_t* wheel, wheel_timer_t* timer, int level, int slot) {
+    wheel_timer_t** head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+    timer->level = level;
+    timer->slot = slot;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+static void insert(timer_wheel_t* wheel, wheel_timer_t* timer) {
+    uint64_t expires = timer->expires;
+
+    // overdue timers go in the slot processed next
+    if (expires < wheel->now) {
+        link_timer(wheel, timer, 0, wheel->now & WHEEL_MASK);
+        return;
+    }
+
+    uint64_t delta = expires - wheel->now;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = level * WHEEL_BITS;
+        if (delta < (1ULL << (shift + WHEEL_BITS)) || level == WHEEL_LEVELS - 1) {
+            if (level == WHEEL_LEVELS - 1 && delta >= (1ULL << (shift + WHEEL_BITS))) {
+                // beyond the wheel's range: park it at the far end, it is
+                // put back when it comes round
+                expires = wheel->now + (1ULL << (shift + WHEEL_BITS)) - 1;
+            }
+            link_timer(wheel, timer, level, (expires >> shift) & WHEEL_MASK);
+            return;
+        }
+    }
+}
+
+void timer_cancel(timer_wheel_t* wheel, wheel_timer_t* timer) {
+    if (!timer->pprev) {
+        return;
+    }
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    if (!wheel->slots[timer->level][timer->slot]) {
+        wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void timer_schedule(timer_wheel_t* wheel, wheel_timer_t* timer, uint64_t expires_ms) {
+    timer_cancel(wheel, timer);
+    timer->expires = (expires_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    insert(wheel, timer);
+}
+
+// take a slot's whole list off the wheel
+static wheel_timer_t* detach_slot(timer_wheel_t* wheel, int level, int slot) {
+    wheel_timer_t* list = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ULL << slot);
+    return list;
+}
+
+// re-insert the timers of a higher-level slot whose span has come up; they
+// land on lower levels now that they are closer
+static void cascade(timer_wheel_t* wheel, int level, int slot) {
+    wheel_timer_t* timer = detach_slot(wheel, level, slot);
+    while (timer) {
+        wheel_timer_t* next = timer->next;
+        insert(wheel, timer);
+        timer = next;
+    }
+}
+
+void timer_wheel_advance(timer_wheel_t* wheel, uint64_t now_ms, void (*expire)(wheel_timer_t*)) {
+    uint64_t target = now_ms / WHEEL_TICK_MS;
+
+    while (wheel->now <= target) {
+        bool empty = true;
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            empty = empty && wheel->occupied[level] == 0;
+        }
+        if (empty) {
+            wheel->now = target + 1;
+            break;
+        }
+
+        int index = wheel->now & WHEEL_MASK;
+        for (int level = 1; index == 0 && level < WHEEL_LEVELS; level++) {
+            index = (wheel->now >> (level * WHEEL_BITS)) & WHEEL_MASK;
+            cascade(wheel, level, index);
+        }
+
+        // fire from a private list, so callbacks that touch the wheel don't
+        // disturb the iteration; cancelling a timer still on it unlinks it.
+        // The tick is over for the wheel once its slot is detached, so a
+        // timer a callback schedules for it or earlier lands in the next
+        // slot, not in the one just emptied a whole revolution away.
+        uint64_t tick = wheel->now++;
+        wheel_timer_t* due = detach_slot(wheel, 0, tick & WHEEL_MASK);
+        if (due) {
+            due->pprev = &due;
+        }
+        while (due) {
+            wheel_timer_t* timer = due;
+            due = timer->next;
+            if (due) {
+                due->pprev = &due;
+            }
+            timer->next = NULL;
+            timer->pprev = NULL;
+            if (timer->expires > tick) {
+                insert(wheel, timer);   // parked beyond the range
+                continue;
+            }
+            expire(timer);
+        }
+    }
+}
+
+int timer_wheel_timeout(const timer_wheel_t* wheel, uint64_t now_ms, int max_ms) {
+    uint64_t next = UINT64_MAX;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t occupied = wheel->occupied[level];
+        if (!occupied) {
+            continue;
+        }
+        int shift = level * WHEEL_BITS;
+        int index = (wheel->now >> shift) & WHEEL_MASK;
+        // bit k of rotated: the slot k steps ahead of the current one
+        uint64_t rotated = index ? (occupied >> index) | (occupied << (WHEEL_SLOTS - index)) : occupied;
+
+        uint64_t tick;
+        if (level == 0) {
+            tick = wheel->now + __builtin_ctzll(rotated);
+        } else {
+            // a higher-level slot is due when the wheel reaches its span;
+            // the current slot only if that is the very next tick
+            bool aligned = (wheel->now & ((1ULL << shift) - 1)) == 0;
+            uint64_t ahead = aligned ? rotated : rotated & ~1ULL;
+            int steps = ahead ? __builtin_ctzll(ahead) : WHEEL_SLOTS;
+            tick = ((wheel->now >> shift) + steps) << shift;
+        }
+        if (tick < next) {
+            next = tick;
+        }
+    }
+
+    if (next == UINT64_MAX) {
+        return max_ms;
+    }
+    uint64_t due_ms = next * WHEEL_TICK_MS;
+    if (due_ms <= now_ms) {
+        return 0;
+    }
+    return due_ms - now_ms < (uint64_t)max_ms ? (int)(due_ms - now_ms) : max_ms;
+}
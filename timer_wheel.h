@@ -0,0 +1,52 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WHEEL_TICK_MS 10
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4              // 64^4 ticks of 10ms, about 46 hours
+
+// intrusive timer, embedded in whatever it times out; zero-initialised
+// means not scheduled
+typedef struct wheel_timer {
+    struct wheel_timer* next;
+    struct wheel_timer** pprev;     // NULL when not scheduled
+    uint64_t expires;               // in ticks
+    uint8_t level;
+    uint8_t slot;
+} wheel_timer_t;
+
+// hierarchical hashed timing wheel, one per worker and never shared. Level 0
+// holds timers due within 64 ticks, one slot per tick; each level above
+// covers 64 times the span of the one below and is cascaded down one slot
+// at a time as the wheel turns. Scheduling and cancelling are O(1); a
+// bitmap of occupied slots per level lets the next expiry be found without
+// scanning.
+typedef struct {
+    uint64_t now;                   // next tick to process
+    uint64_t occupied[WHEEL_LEVELS];
+    wheel_timer_t* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} timer_wheel_t;
+
+void timer_wheel_init(timer_wheel_t* wheel, uint64_t now_ms);
+
+// (re)schedule to fire at expires_ms; rounded up to the next tick
+void timer_schedule(timer_wheel_t* wheel, wheel_timer_t* timer, uint64_t expires_ms);
+void timer_cancel(timer_wheel_t* wheel, wheel_timer_t* timer);
+
+static inline bool timer_pending(const wheel_timer_t* timer) {
+    return timer->pprev != NULL;
+}
+
+// fire every timer due at now_ms; a timer is unscheduled before its
+// callback runs, which may cancel or schedule any timer, itself included
+void timer_wheel_advance(timer_wheel_t* wheel, uint64_t now_ms, void (*expire)(wheel_timer_t*));
+
+// milliseconds until the wheel next needs advancing, at most max_ms
+int timer_wheel_timeout(const timer_wheel_t* wheel, uint64_t now_ms, int max_ms);
+
+#endif
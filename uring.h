@@ -0,0 +1,90 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// minimal io_uring wrapper on the raw syscalls: ring setup, SQE allocation,
+// batched submission and CQE iteration, plus provided buffer rings for
+// multishot recv. One ring per worker thread, never shared.
+typedef struct {
+    int fd;
+    unsigned features;
+
+    // submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned sqe_tail;          // SQEs handed out but not yet published
+
+    // completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring_ptr;
+    size_t sq_ring_size;
+    void* cq_ring_ptr;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring_t;
+
+// kernel-shared ring of recv buffers the kernel picks from (IOSQE_BUFFER_SELECT)
+typedef struct {
+    struct io_uring_buf_ring* ring;
+    char* base;
+    unsigned entries;
+    unsigned buf_size;
+    uint16_t bgid;
+    uint16_t tail;
+} uring_buf_ring_t;
+
+// returns 0 or -errno
+int uring_init(uring_t* ring, unsigned entries);
+void uring_exit(uring_t* ring);
+
+// next free SQE, zeroed; submits what is queued first if the SQ is full
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+
+// submit everything queued with one io_uring_enter and wait until at least
+// wait_nr completions are ready or timeout_ms passes (-1 waits forever)
+// returns the number submitted or -errno
+int uring_submit_and_wait(uring_t* ring, unsigned wait_nr, int timeout_ms);
+
+// completions: peek at the next one, then mark it consumed
+static inline struct io_uring_cqe* uring_peek_cqe(uring_t* ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+static inline void uring_cqe_seen(uring_t* ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void uring_prep_multishot_accept(struct io_uring_sqe* sqe, int fd, uint64_t user_data);
+void uring_prep_multishot_recv(struct io_uring_sqe* sqe, int fd, uint16_t bgid, uint64_t user_data);
+void uring_prep_send(struct io_uring_sqe* sqe, int fd, const void* buf, size_t len, uint64_t user_data);
+void uring_prep_cancel(struct io_uring_sqe* sqe, uint64_t target, uint64_t user_data);
+
+// register entries buffers of buf_size bytes under group bgid; 0 or -errno
+int uring_buf_ring_setup(uring_t* ring, uring_buf_ring_t* br, unsigned entries,
+                         unsigned buf_size, uint16_t bgid);
+void uring_buf_ring_free(uring_t* ring, uring_buf_ring_t* br);
+
+static inline char* uring_buf_ring_addr(const uring_buf_ring_t* br, uint16_t bid) {
+    return br->base + (size_t)bid * br->buf_size;
+}
+
+// hand a consumed buffer back to the kernel
+void uring_buf_ring_recycle(uring_buf_ring_t* br, uint16_t bid);
+
+#endif